@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "scaler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The video task shared by the emulators. It takes frames from the frame
+// exchange and puts them on the panel in stages,
+//
+//   source -> palette -> scaler -> overlay -> sink
+//
+// following a frame band by band while it is still being drawn. The
+// emulators only describe their frames and pick a scaler for the video
+// setting, everything else (the task, the panel window, the transfer
+// buffers) lives here.
+
+enum DisplaySourceFormat {
+  // colors in panel byte order (see make_color)
+  DISPLAY_SOURCE_RGB565,
+  // palette indices, looked up in the palette set with
+  // display_pipeline_set_palette()
+  DISPLAY_SOURCE_INDEXED,
+};
+
+// the frames the emulator hands to the frame exchange
+struct DisplaySource {
+  enum DisplaySourceFormat format;
+  int width;
+  int height;
+  int pitch; // bytes from one line to the next
+};
+
+// Called with every chunk of output lines right before it goes to the
+// panel. The chunk starts first_y lines from the top of a width x height
+// window, a frame starts with first_y 0.
+typedef void (*display_overlay_fn)(uint16_t *lines, int first_y, int num_lines,
+                                   int width, int height);
+
+void display_pipeline_init(const struct DisplaySource *source);
+void display_pipeline_set_palette(const uint16_t *palette);
+// the scaler for the current video setting, NULL shows frames 1:1 in the
+// middle of the screen. Takes effect with the next frame.
+void display_pipeline_set_scaler(const struct Scaler *scaler);
+void display_pipeline_set_overlay(display_overlay_fn overlay);
+
+// runs the video task on core 1, stopping waits for the frame it is on
+void display_pipeline_start();
+void display_pipeline_stop();
+
+void display_pipeline_print_stats();
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Triple buffered hand-off of frames from the emulation task to the video
+// task. The emulator always owns one buffer (the back buffer) and can always
+// move on to another one when it finishes a frame, so it never waits on the
+// display. The video task shows the newest frame, and may start on the back
+// buffer while it is still being drawn, following it as lines are finished.
+void frame_exchange_init(uint8_t *buffer0, uint8_t *buffer1, uint8_t *buffer2, int num_lines);
+
+// emulator side, none of these block
+uint8_t *frame_exchange_back();
+// the first num_lines lines of the back buffer are final
+void frame_exchange_lines_done(int num_lines);
+// the back buffer holds a complete frame, frame_exchange_back() changes
+void frame_exchange_publish();
+// the most recently completed frame (for screenshots)
+const uint8_t *frame_exchange_latest();
+
+// video task side. Returns a frame newer than the last one acquired, or NULL
+// if none showed up within timeout_ms.
+const uint8_t *frame_exchange_acquire(uint32_t timeout_ms);
+// Waits until more than num_lines lines of the acquired frame are final and
+// returns how many are. Returns num_lines if nothing changed within
+// timeout_ms.
+int frame_exchange_wait_lines(int num_lines, uint32_t timeout_ms);
+void frame_exchange_release();
+
+void frame_exchange_print_stats();
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_POLICY_MAX_SPEED 8
+
+// Shared frame policy for the emulator cores. The emulation task calls
+// frame_policy_begin_frame() / frame_policy_end_frame() around every emulated
+// frame; the renderer and audio paths ask whether this frame should be drawn
+// and whether its audio should go out to the speaker. How many frames get
+// drawn adapts to the measured emulation and blit cost.
+void frame_policy_reset();
+void frame_policy_begin_frame();
+void frame_policy_end_frame();
+// called by the video task with the time it took to put a frame on screen
+void frame_policy_report_blit_us(int64_t us);
+int frame_policy_should_render();
+int frame_policy_should_play_audio();
+// how long a frame should take (from its start) before the next one begins
+int64_t frame_policy_frame_period_us();
+
+// speed multiplier, 1 is normal speed and 2-8 is turbo
+int frame_policy_get_speed();
+void frame_policy_set_speed(int multiplier);
+// steps through 1x, 2x, 4x, 8x (A+B+RIGHT)
+void frame_policy_cycle_speed();
+
+void frame_policy_print_stats();
+
+#ifdef __cplusplus
+}
+#endif
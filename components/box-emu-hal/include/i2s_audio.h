@@ -12,6 +12,8 @@ extern "C" {
 void audio_init();
 int16_t* get_audio_buffer();
 void audio_play_frame(uint8_t *data, uint32_t num_bytes);
+// time spent blocked in audio_play_frame since the last call
+int64_t audio_take_write_time_us();
 
 bool is_muted();
 void set_muted(bool mute);
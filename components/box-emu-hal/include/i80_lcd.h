@@ -9,13 +9,35 @@ extern "C"
 #endif
 
 #define NUM_ROWS_IN_FRAME_BUFFER 40
+#define NUM_ROWS_IN_POOL_BUFFER 20
 
+// RGB565 in the byte order the panel takes it over the 8 bit bus (high byte
+// first), so frames built from these go out without any swapping
 uint16_t make_color(uint8_t r, uint8_t g, uint8_t b);
+// Waits for a free buffer of NUM_ROWS_IN_POOL_BUFFER full width lines to
+// build pixels in. Once it is passed to lcd_write_frame()/lcd_write_window()
+// it returns to the pool by itself when the transfer is done, so callers can
+// fill several ahead of the bus but must send every buffer they take.
+uint16_t* lcd_get_buffer();
 uint16_t* get_vram0();
 uint16_t* get_vram1();
 uint8_t* get_frame_buffer0();
 uint8_t* get_frame_buffer1();
 void lcd_write_frame(const uint16_t x, const uint16_t y, const uint16_t width, const uint16_t height, const uint8_t *data);
+// Sets the panel's column and row range once, after which lcd_write_window()
+// streams pixels into it back to back, each write carrying on where the last
+// one stopped, with no addressing commands in between. Each call is safe from
+// any task, but a window spans several calls, so only one task may be writing
+// windows at a time: the video task while a game runs, display_clear()
+// callers otherwise.
+void lcd_begin_window(const uint16_t x, const uint16_t y, const uint16_t width, const uint16_t height);
+void lcd_write_window(const uint8_t *data, size_t num_bytes);
+// Waits for the panel's (estimated) next refresh so a frame written into a
+// window right after starts with the scan. Frames started this way are
+// counted as late if they are still being sent when the following refresh
+// starts.
+void lcd_wait_vsync();
+void lcd_print_stats();
 void lcd_init();
 void display_clear();
 
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Small status sprites (volume bar, save icon, frame rate) drawn on top of
+// the game as its lines go out to the panel, so showing them neither pauses
+// emulation nor wakes up LVGL. The show functions can be called from any
+// task, the sprites are redrawn by the video task when they change.
+void overlay_show_volume(int percent);
+void overlay_show_saved();
+
+// display pipeline overlay stage (see display_pipeline_set_overlay)
+void overlay_draw(uint16_t *lines, int first_y, int num_lines, int width, int height);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Serialize the running emulator into buffer, returning the number of bytes
+// written or 0 if it could not be saved.
+typedef size_t (*rewind_save_fn)(uint8_t *buffer, size_t capacity);
+// Restore the emulator from a buffer previously filled by the save function.
+typedef bool (*rewind_load_fn)(const uint8_t *buffer, size_t size);
+
+void rewind_init(size_t max_state_size, rewind_save_fn save, rewind_load_fn load);
+void rewind_reset();
+void rewind_deinit();
+
+// Called from the input handling (A+B+LEFT chord) while rewind is held.
+void rewind_set_active(bool active);
+bool rewind_is_active();
+
+// Called once per frame from the emulation task, before the frame is run.
+// Captures / encodes snapshots or, while rewind is held, restores them.
+// Returns whether the frame should be emulated: while rewind is held only
+// the frame after each restore is, so the snapshot shows up on screen, the
+// ones in between are skipped (still paced, with the sound off).
+bool rewind_update();
+
+void rewind_print_stats();
+
+#ifdef __cplusplus
+}
+#endif
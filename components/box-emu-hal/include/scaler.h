@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SCALER_MAX_WIDTH 320
+#define SCALER_MAX_HEIGHT 240
+
+enum ScalerFilter {
+  // repeats source pixels, what the emulators always did
+  SCALER_NEAREST,
+  // blends only across the edges between source pixels, which stay sharp
+  // at integer scales and don't shimmer at the fractional ones
+  SCALER_SHARP_BILINEAR,
+  // blends horizontally between the two nearest source pixels, lines are
+  // repeated
+  SCALER_BILINEAR_H,
+};
+
+#if defined(CONFIG_SCALER_FILTER_SHARP_BILINEAR)
+#define SCALER_DEFAULT_FILTER SCALER_SHARP_BILINEAR
+#elif defined(CONFIG_SCALER_FILTER_BILINEAR_H)
+#define SCALER_DEFAULT_FILTER SCALER_BILINEAR_H
+#else
+#define SCALER_DEFAULT_FILTER SCALER_NEAREST
+#endif
+
+// Scales frames of colors in panel byte order (see make_color) line by line.
+// Which source pixels each output pixel comes from, and how much of each,
+// is worked out once into these tables, so scaling a line is only lookups
+// and fixed point blends. Weights are in 32nds of the next source pixel.
+struct Scaler {
+  int src_width;
+  int src_height;
+  int dst_width;
+  int dst_height;
+  enum ScalerFilter filter;
+  uint16_t x_index[SCALER_MAX_WIDTH];
+  uint8_t x_weight[SCALER_MAX_WIDTH];
+  uint16_t y_index[SCALER_MAX_HEIGHT];
+  uint8_t y_weight[SCALER_MAX_HEIGHT];
+};
+
+// Builds the tables for a mode. Nothing is written if they were already
+// built for the same sizes and filter, so a scaler the video task is using
+// can be set up again safely.
+void scaler_init(struct Scaler *scaler, int src_width, int src_height,
+                 int dst_width, int dst_height, enum ScalerFilter filter);
+// how many source lines have to be final before output line dst_y can be
+// made
+int scaler_lines_needed(const struct Scaler *scaler, int dst_y);
+// output line dst_y from a frame of colors, stride is in pixels
+void scaler_line(const struct Scaler *scaler, uint16_t *dst, int dst_y,
+                 const uint16_t *frame, int stride);
+// output line dst_y from a frame of palette indices, pitch is in bytes
+void scaler_line_indexed(const struct Scaler *scaler, uint16_t *dst, int dst_y,
+                         const uint8_t *frame, int pitch, const uint16_t *palette);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The emulators report finished scanlines to their video task in bands of
+// this many lines, so that converting / sending band k on core 1 overlaps
+// with emulating band k+1 on core 0 instead of waiting for the whole frame.
+#define VIDEO_BAND_LINES 16
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,7 @@
+#include "i80_lcd.h"
+
+extern "C" uint16_t make_color(uint8_t r, uint8_t g, uint8_t b) {
+  uint16_t color = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+  // high byte first in memory
+  return (color >> 8) | (color << 8);
+}
@@ -0,0 +1,193 @@
+#include "display_pipeline.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string.h>
+
+#include "esp_timer.h"
+
+#include "format.hpp"
+#include "task.hpp"
+
+#include "frame_exchange.h"
+#include "frame_policy.h"
+#include "i80_lcd.h"
+
+static constexpr int SCREEN_WIDTH = 320;
+static constexpr int SCREEN_HEIGHT = 240;
+
+static DisplaySource source_ = {
+  .format = DISPLAY_SOURCE_RGB565,
+  .width = 0,
+  .height = 0,
+  .pitch = 0,
+};
+static std::atomic<const uint16_t*> palette_{nullptr};
+static std::atomic<const Scaler*> scaler_{nullptr};
+static std::atomic<display_overlay_fn> overlay_{nullptr};
+static std::shared_ptr<espp::Task> task_;
+
+// what the last frame was shown with, the screen is cleared when it changes
+static const Scaler *last_scaler_ = nullptr;
+static bool shown_any_ = false;
+
+// stats, reset each time they are printed
+static std::atomic<int> frames_{0};
+static std::atomic<int> stalls_{0};
+static std::atomic<int64_t> source_us_{0};
+static std::atomic<int64_t> convert_us_{0};
+static std::atomic<int64_t> overlay_us_{0};
+static std::atomic<int64_t> sink_us_{0};
+
+// palette and scaler stages, one output line
+static void convert_line(const Scaler *scaler, const uint16_t *palette, uint16_t *dst,
+                         int dst_y, const uint8_t *frame) {
+  if (source_.format == DISPLAY_SOURCE_INDEXED) {
+    if (scaler) {
+      scaler_line_indexed(scaler, dst, dst_y, frame, source_.pitch, palette);
+      return;
+    }
+    const uint8_t *src = &frame[dst_y * source_.pitch];
+    for (int x = 0; x < source_.width; x++) {
+      dst[x] = palette[src[x]];
+    }
+  } else {
+    if (scaler) {
+      scaler_line(scaler, dst, dst_y, (const uint16_t*)frame, source_.pitch / sizeof(uint16_t));
+      return;
+    }
+    memcpy(dst, &frame[dst_y * source_.pitch], source_.width * sizeof(uint16_t));
+  }
+}
+
+static bool run_frame(std::mutex &m, std::condition_variable &cv) {
+  const uint8_t *frame = frame_exchange_acquire(100);
+  if (!frame) {
+    return false;
+  }
+  // start writing with the panel's refresh, so the frame goes out ahead of
+  // its scan instead of across it
+  lcd_wait_vsync();
+
+  // the stages are picked up once per frame, since the window they need is
+  // set up on the panel when the frame starts
+  const Scaler *scaler = scaler_;
+  const uint16_t *palette = palette_;
+  display_overlay_fn overlay = overlay_;
+  if (shown_any_ && scaler != last_scaler_) {
+    display_clear();
+  }
+  last_scaler_ = scaler;
+  shown_any_ = true;
+  int width = scaler ? scaler->dst_width : source_.width;
+  int height = scaler ? scaler->dst_height : source_.height;
+  int x_offset = (SCREEN_WIDTH - width) / 2;
+  int y_offset = (SCREEN_HEIGHT - height) / 2;
+  lcd_begin_window(x_offset, y_offset, width, height);
+
+  // the frame may still be being drawn, write out every output line as soon
+  // as the source lines it needs are final
+  int64_t source_us = 0;
+  int64_t convert_us = 0;
+  int64_t overlay_us = 0;
+  int64_t sink_us = 0;
+  int lines = 0;
+  int next_y = 0;
+  while (next_y < height) {
+    int num_lines = 0;
+    while (num_lines < NUM_ROWS_IN_POOL_BUFFER && next_y + num_lines < height &&
+           (scaler ? scaler_lines_needed(scaler, next_y + num_lines) : next_y + num_lines + 1) <= lines) {
+      num_lines++;
+    }
+    if (num_lines == 0) {
+      int64_t start = esp_timer_get_time();
+      int lines_ready = frame_exchange_wait_lines(lines, 100);
+      source_us += esp_timer_get_time() - start;
+      if (lines_ready <= lines) {
+        fmt::print("display: frame stalled at line {}\n", lines);
+        stalls_++;
+        break;
+      }
+      lines = lines_ready;
+      continue;
+    }
+    int64_t start = esp_timer_get_time();
+    uint16_t *buffer = lcd_get_buffer();
+    int64_t converted = esp_timer_get_time();
+    for (int i = 0; i < num_lines; i++) {
+      convert_line(scaler, palette, &buffer[i * width], next_y + i, frame);
+    }
+    int64_t overlaid = esp_timer_get_time();
+    if (overlay) {
+      overlay(buffer, next_y, num_lines, width, height);
+    }
+    int64_t sent = esp_timer_get_time();
+    lcd_write_window((const uint8_t*)buffer, num_lines * width * sizeof(uint16_t));
+    int64_t end = esp_timer_get_time();
+    sink_us += (converted - start) + (end - sent);
+    convert_us += overlaid - converted;
+    overlay_us += sent - overlaid;
+    next_y += num_lines;
+  }
+  frame_exchange_release();
+  frame_policy_report_blit_us(convert_us + overlay_us + sink_us);
+  frames_++;
+  source_us_ += source_us;
+  convert_us_ += convert_us;
+  overlay_us_ += overlay_us;
+  sink_us_ += sink_us;
+  return false;
+}
+
+extern "C" void display_pipeline_init(const DisplaySource *source) {
+  source_ = *source;
+  palette_ = nullptr;
+  scaler_ = nullptr;
+  overlay_ = nullptr;
+  shown_any_ = false;
+}
+
+extern "C" void display_pipeline_set_palette(const uint16_t *palette) {
+  palette_ = palette;
+}
+
+extern "C" void display_pipeline_set_scaler(const Scaler *scaler) {
+  scaler_ = scaler;
+}
+
+extern "C" void display_pipeline_set_overlay(display_overlay_fn overlay) {
+  overlay_ = overlay;
+}
+
+extern "C" void display_pipeline_start() {
+  if (!task_) {
+    task_ = std::make_shared<espp::Task>(espp::Task::Config{
+        .name = "video task",
+        .callback = run_frame,
+        .stack_size_bytes = 10*1024,
+        .priority = 20,
+        .core_id = 1
+      });
+  }
+  task_->start();
+}
+
+extern "C" void display_pipeline_stop() {
+  if (task_) {
+    task_->stop();
+  }
+}
+
+extern "C" void display_pipeline_print_stats() {
+  int frames = std::max((int)frames_, 1);
+  fmt::print("display: {} frames ({} stalled), per frame: source {} us, convert {} us, overlay {} us, sink {} us\n",
+             (int)frames_, (int)stalls_, source_us_ / frames, convert_us_ / frames,
+             overlay_us_ / frames, sink_us_ / frames);
+  frames_ = 0;
+  stalls_ = 0;
+  source_us_ = 0;
+  convert_us_ = 0;
+  overlay_us_ = 0;
+  sink_us_ = 0;
+}
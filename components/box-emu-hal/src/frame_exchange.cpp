@@ -0,0 +1,215 @@
+#include "frame_exchange.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_attr.h"
+
+#include "format.hpp"
+
+/**
+ * All of the bookkeeping lives in one 32 bit word that both sides update
+ * with compare-and-swap, so neither side ever holds a lock the other has to
+ * wait for:
+ *
+ *   back   buffer the emulator is drawing into
+ *   ready  most recently completed frame
+ *   front  buffer the video task is reading (NONE when idle). This is the
+ *          back buffer when it follows a frame that is still being drawn.
+ *   fresh  the ready frame has not been shown
+ *   seen   the video task already took the frame in the back buffer
+ *   lines  how many lines of the back buffer are final
+ *
+ * When a frame completes the emulator moves on to a buffer that is neither
+ * the one it just finished nor the front buffer; with three there always is
+ * one. The semaphore only wakes the video task up, the emulator never waits
+ * on it.
+ */
+
+static constexpr int NUM_BUFFERS = 3;
+static constexpr uint32_t NONE = 3;
+// the video task counts a repeated frame for every refresh period it spends
+// waiting for a new one
+static constexpr TickType_t REFRESH_TICKS = std::max<TickType_t>(pdMS_TO_TICKS(17), 1);
+
+struct State {
+  uint32_t back;
+  uint32_t ready;
+  uint32_t front;
+  bool fresh;
+  bool seen;
+  uint32_t lines;
+};
+
+static uint32_t pack(const State &s) {
+  return s.back | (s.ready << 2) | (s.front << 4) | (s.fresh << 6) | (s.seen << 7) | (s.lines << 8);
+}
+
+static State unpack(uint32_t word) {
+  return {
+    .back = word & 3,
+    .ready = (word >> 2) & 3,
+    .front = (word >> 4) & 3,
+    .fresh = ((word >> 6) & 1) != 0,
+    .seen = ((word >> 7) & 1) != 0,
+    .lines = word >> 8,
+  };
+}
+
+static std::atomic<uint32_t> state_{0};
+static uint8_t *buffers_[NUM_BUFFERS] = {nullptr, nullptr, nullptr};
+static int num_lines_ = 0;
+static SemaphoreHandle_t wakeup_ = nullptr;
+
+// stats, reset each time they are printed
+static std::atomic<int> published_{0};
+static std::atomic<int> shown_{0};
+static std::atomic<int> dropped_{0};
+static std::atomic<int> repeated_{0};
+
+// applies f to the state until it sticks and returns the new state. f may
+// run more than once, so it must only assign to what it captures.
+template <typename F>
+static State update(F &&f) {
+  uint32_t word = state_.load();
+  State s;
+  do {
+    s = unpack(word);
+    f(s);
+  } while (!state_.compare_exchange_weak(word, pack(s)));
+  return s;
+}
+
+static uint32_t next_back(uint32_t finished, uint32_t front) {
+  for (uint32_t i = 0; i < NUM_BUFFERS; i++) {
+    if (i != finished && i != front) {
+      return i;
+    }
+  }
+  return finished;
+}
+
+extern "C" void frame_exchange_init(uint8_t *buffer0, uint8_t *buffer1, uint8_t *buffer2, int num_lines) {
+  buffers_[0] = buffer0;
+  buffers_[1] = buffer1;
+  buffers_[2] = buffer2;
+  num_lines_ = num_lines;
+  state_ = pack({.back = 0, .ready = 1, .front = NONE, .fresh = false, .seen = false, .lines = 0});
+  if (!wakeup_) {
+    wakeup_ = xSemaphoreCreateBinary();
+  }
+  published_ = 0;
+  shown_ = 0;
+  dropped_ = 0;
+  repeated_ = 0;
+}
+
+extern "C" uint8_t *frame_exchange_back() {
+  return buffers_[unpack(state_.load()).back];
+}
+
+extern "C" void IRAM_ATTR frame_exchange_lines_done(int num_lines) {
+  update([&](State &s) {
+    s.lines = num_lines;
+  });
+  xSemaphoreGive(wakeup_);
+}
+
+extern "C" void frame_exchange_publish() {
+  bool dropped = false;
+  update([&](State &s) {
+    dropped = s.fresh;
+    // if the video task followed this frame while it was drawn it has
+    // already been shown
+    s.fresh = !s.seen;
+    s.ready = s.back;
+    s.back = next_back(s.back, s.front);
+    s.seen = false;
+    s.lines = 0;
+  });
+  ++published_;
+  if (dropped) {
+    ++dropped_;
+  }
+  xSemaphoreGive(wakeup_);
+}
+
+extern "C" const uint8_t *frame_exchange_latest() {
+  return buffers_[unpack(state_.load()).ready];
+}
+
+extern "C" const uint8_t *frame_exchange_acquire(uint32_t timeout_ms) {
+  frame_exchange_release();
+  TickType_t start = xTaskGetTickCount();
+  TickType_t timeout = pdMS_TO_TICKS(timeout_ms);
+  while (true) {
+    bool found = false;
+    bool skipped = false;
+    State now = update([&](State &s) {
+      found = false;
+      skipped = false;
+      if (s.lines > 0 && !s.seen) {
+        // the frame being drawn is newer than anything that is ready
+        skipped = s.fresh;
+        s.front = s.back;
+        s.seen = true;
+        s.fresh = false;
+        found = true;
+      } else if (s.fresh) {
+        s.front = s.ready;
+        s.fresh = false;
+        found = true;
+      }
+    });
+    if (found) {
+      if (skipped) {
+        ++dropped_;
+      }
+      ++shown_;
+      return buffers_[now.front];
+    }
+    TickType_t waited = xTaskGetTickCount() - start;
+    if (waited >= timeout) {
+      return nullptr;
+    }
+    if (xSemaphoreTake(wakeup_, std::min(REFRESH_TICKS, timeout - waited)) != pdTRUE) {
+      ++repeated_;
+    }
+  }
+}
+
+extern "C" int frame_exchange_wait_lines(int num_lines, uint32_t timeout_ms) {
+  TickType_t start = xTaskGetTickCount();
+  TickType_t timeout = pdMS_TO_TICKS(timeout_ms);
+  while (true) {
+    State s = unpack(state_.load());
+    // once the emulator moved on from the front buffer all of it is final
+    int lines = s.front == s.back ? (int)s.lines : num_lines_;
+    if (lines > num_lines) {
+      return lines;
+    }
+    TickType_t waited = xTaskGetTickCount() - start;
+    if (waited >= timeout) {
+      return num_lines;
+    }
+    xSemaphoreTake(wakeup_, timeout - waited);
+  }
+}
+
+extern "C" void frame_exchange_release() {
+  update([](State &s) {
+    s.front = NONE;
+  });
+}
+
+extern "C" void frame_exchange_print_stats() {
+  fmt::print("frame exchange: shown {}/{} frames, dropped {}, repeated {}\n",
+             (int)shown_, (int)published_, (int)dropped_, (int)repeated_);
+  published_ = 0;
+  shown_ = 0;
+  dropped_ = 0;
+  repeated_ = 0;
+}
@@ -0,0 +1,162 @@
+#include "frame_policy.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include "esp_attr.h"
+#include "esp_timer.h"
+
+#include "format.hpp"
+#include "i2s_audio.h"
+
+/**
+ * At normal speed the policy renders every Nth frame, where N (the render
+ * interval) is the smallest value for which both
+ *
+ *   emulating N frames, one of them rendered, fits in N frame times
+ *   blitting the rendered frame fits in N frame times
+ *
+ * using running averages of the measured costs. The emulation cost excludes
+ * time spent blocked on the I2S write, which is idle time. Easy scenes get
+ * every frame drawn, heavy ones back off towards MAX_RENDER_INTERVAL.
+ */
+
+static constexpr int NATIVE_FRAME_RATE = 60;
+static constexpr int64_t FRAME_BUDGET_US = 1000000 / NATIVE_FRAME_RATE;
+// at normal speed audio_play_frame() blocks on the I2S driver and is what
+// really paces emulation, this is just a floor (1/60 negatively affects
+// sound, so 1/128 it is)
+static constexpr int64_t NORMAL_FRAME_PERIOD_US = 1000000 / 128;
+static constexpr int MAX_RENDER_INTERVAL = 6;
+// leave some slack when stepping up the interval, and more before stepping
+// back down so we don't oscillate
+static constexpr float KEEP_HEADROOM = 0.95f;
+static constexpr float IMPROVE_HEADROOM = 0.8f;
+
+static std::atomic<int> speed_{1};
+static bool render_ = true;
+static bool play_audio_ = true;
+static int render_interval_ = 2;
+static int frames_since_render_ = 0;
+static int64_t frame_start_us_ = 0;
+
+// running averages (1/8 weight per sample)
+static int64_t emu_render_us_ = 0;
+static int64_t emu_skip_us_ = 0;
+static std::atomic<int64_t> blit_us_{0};
+
+// stats, reset each time they are printed
+static int64_t stats_start_us_ = 0;
+static int frames_ = 0;
+static int rendered_frames_ = 0;
+
+static int64_t average(int64_t avg, int64_t sample) {
+  return avg ? (avg * 7 + sample) / 8 : sample;
+}
+
+static bool fits(int interval, float headroom) {
+  float budget = interval * FRAME_BUDGET_US * headroom;
+  return emu_render_us_ + (interval - 1) * emu_skip_us_ <= budget
+    && blit_us_ <= budget;
+}
+
+static void update_render_interval() {
+  if (!fits(render_interval_, KEEP_HEADROOM)) {
+    render_interval_ = std::min(render_interval_ + 1, MAX_RENDER_INTERVAL);
+  } else if (render_interval_ > 1 && fits(render_interval_ - 1, IMPROVE_HEADROOM)) {
+    render_interval_--;
+  }
+}
+
+extern "C" void frame_policy_reset() {
+  speed_ = 1;
+  render_ = true;
+  play_audio_ = true;
+  render_interval_ = 2;
+  frames_since_render_ = 0;
+  emu_render_us_ = 0;
+  emu_skip_us_ = 0;
+  blit_us_ = 0;
+  audio_take_write_time_us();
+  stats_start_us_ = esp_timer_get_time();
+  frames_ = 0;
+  rendered_frames_ = 0;
+}
+
+extern "C" void frame_policy_begin_frame() {
+  int speed = speed_;
+  // in turbo keep the display at roughly the rate it gets at normal speed.
+  // the emulated audio is still mixed so the sound state stays correct but
+  // is never played since it would pace us back to real time
+  int interval = speed <= 1 ? render_interval_ : 2 * speed;
+  render_ = frames_since_render_ + 1 >= interval;
+  frames_since_render_ = render_ ? 0 : frames_since_render_ + 1;
+  play_audio_ = speed <= 1;
+  frame_start_us_ = esp_timer_get_time();
+  // don't count blocking from before this frame
+  audio_take_write_time_us();
+}
+
+extern "C" void frame_policy_end_frame() {
+  int64_t busy = esp_timer_get_time() - frame_start_us_ - audio_take_write_time_us();
+  if (render_) {
+    emu_render_us_ = average(emu_render_us_, busy);
+  } else {
+    emu_skip_us_ = average(emu_skip_us_, busy);
+  }
+  update_render_interval();
+  ++frames_;
+  if (render_) {
+    ++rendered_frames_;
+  }
+}
+
+extern "C" void frame_policy_report_blit_us(int64_t us) {
+  blit_us_ = average(blit_us_, us);
+}
+
+extern "C" int IRAM_ATTR frame_policy_should_render() {
+  return render_;
+}
+
+extern "C" int frame_policy_should_play_audio() {
+  return play_audio_;
+}
+
+extern "C" int64_t frame_policy_frame_period_us() {
+  int speed = speed_;
+  if (speed <= 1) {
+    return NORMAL_FRAME_PERIOD_US;
+  }
+  return FRAME_BUDGET_US / speed;
+}
+
+extern "C" int frame_policy_get_speed() {
+  return speed_;
+}
+
+extern "C" void frame_policy_set_speed(int multiplier) {
+  speed_ = std::clamp(multiplier, 1, FRAME_POLICY_MAX_SPEED);
+}
+
+extern "C" void frame_policy_cycle_speed() {
+  int speed = speed_ * 2;
+  frame_policy_set_speed(speed > FRAME_POLICY_MAX_SPEED ? 1 : speed);
+}
+
+extern "C" void frame_policy_print_stats() {
+  int64_t now = esp_timer_get_time();
+  float elapsed = (now - stats_start_us_) / 1e6f;
+  if (elapsed <= 0 || frames_ == 0) {
+    return;
+  }
+  float achieved = (float)frames_ / elapsed / NATIVE_FRAME_RATE;
+  fmt::print("frame policy: speed {}x (achieved {:.2f}x), rendered {}/{} frames ({:.0f}%), "
+             "interval {}, emu {}/{}us, blit {}us\n",
+             (int)speed_, achieved, rendered_frames_, frames_,
+             100.0f * rendered_frames_ / frames_, render_interval_,
+             emu_render_us_, emu_skip_us_, (int64_t)blit_us_);
+  stats_start_us_ = now;
+  frames_ = 0;
+  rendered_frames_ = 0;
+}
@@ -12,6 +12,7 @@
 
 #include "esp_system.h"
 #include "esp_check.h"
+#include "esp_timer.h"
 
 #include "i2c.hpp"
 #include "task.hpp"
@@ -42,6 +43,8 @@ static uint8_t amp_read[2];
 
 static std::atomic<bool> muted_{false};
 static std::atomic<int> volume_{60};
+// time spent blocked in i2s_channel_write, i.e. time the emulator was idle
+static std::atomic<int64_t> write_time_us_{0};
 
 int16_t *get_audio_buffer() {
   return audio_buffer;
@@ -156,7 +159,9 @@ void audio_deinit() {
 void audio_play_frame(uint8_t *data, uint32_t num_bytes) {
   size_t bytes_written = 0;
   auto err = ESP_OK;
+  int64_t start = esp_timer_get_time();
   err = i2s_channel_write(tx_handle, data, num_bytes, &bytes_written, 1000);
+  write_time_us_ += esp_timer_get_time() - start;
   if(num_bytes != bytes_written) {
     printf("ERROR to write %ld != written %d\n", num_bytes, bytes_written);
   }
@@ -164,3 +169,7 @@ void audio_play_frame(uint8_t *data, uint32_t num_bytes) {
     printf("ERROR writing i2s channel: %d, '%s'\n", err, esp_err_to_name(err));
   }
 }
+
+int64_t audio_take_write_time_us() {
+  return write_time_us_.exchange(0);
+}
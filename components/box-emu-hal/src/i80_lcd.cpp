@@ -1,18 +1,23 @@
 #include <stdio.h>
 #include <math.h>
+#include <atomic>
+#include <mutex>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "esp_timer.h"
 #include "driver/ledc.h"
 #include "esp_lcd_panel_io.h"
 #include "esp_lcd_panel_vendor.h"
 #include "esp_lcd_panel_ops.h"
+#include "esp_lcd_panel_commands.h"
 #include "driver/gpio.h"
 #include "esp_err.h"
 #include "esp_log.h"
 #include "lvgl.h"
 
 #include "display.hpp"
+#include "format.hpp"
 #include "task.hpp"
 
 #include "pindefs.h"
@@ -31,6 +36,22 @@ std::shared_ptr<espp::Display> display;
 #define LCD_CMD_BITS           8
 #define LCD_PARAM_BITS         8
 
+// st7789 memory write continue: carries on from where the last write stopped
+#define LCD_CMD_RAMWRC         0x3C
+// st7789 frame rate control in normal mode, 0x0F is 60 Hz
+#define LCD_CMD_FRCTRL2        0xC6
+#define LCD_FRCTRL2_60HZ       0x0F
+
+// The badge doesn't wire up the panel's TE (or RD) pin, so there is no way
+// to see where its scan is. Vsync is estimated instead: the panel is set to
+// 60 Hz and assumed to start a refresh every period from when it was turned
+// on. The panel's oscillator isn't exact, so the phase wanders; this keeps
+// presentation regular rather than guaranteeing the scan position.
+static constexpr int64_t VSYNC_PERIOD_US = 1000000 / 60;
+// a frame that is ready this soon after a vsync starts right away
+static constexpr int64_t VSYNC_SLACK_US = 1000;
+static int64_t vsync_origin_us_ = 0;
+
 #define LVGL_TICK_PERIOD_MS    2
 
 // Supported alignment: 16, 32, 64. A higher alignment can enables higher burst transfer size, thus a higher i80 bus throughput.
@@ -38,6 +59,7 @@ std::shared_ptr<espp::Display> display;
 
 static lv_disp_drv_t disp_drv;      // contains callback functions
 esp_lcd_panel_handle_t panel_handle = NULL;
+static esp_lcd_panel_io_handle_t io_handle = NULL;
 
 // alloc draw buffers used by LVGL
 // it's recommended to choose the size of the draw buffer(s) to be at least 1/10 screen sized
@@ -49,27 +71,109 @@ static constexpr size_t frame_buffer_size = LCD_H_RES * LCD_V_RES * 2;
 static uint8_t *frame_buffer0;
 static uint8_t *frame_buffer1;
 
+// Buffers the emulators build pixels in, carved out of the two LVGL draw
+// buffers (LVGL is paused while a game runs). A buffer goes back to free_
+// from on_color_trans_done once the DMA sending it is done, so it is never
+// overwritten while it is still going out.
+static constexpr int NUM_POOL_BUFFERS = 2 * NUM_ROWS_IN_FRAME_BUFFER / NUM_ROWS_IN_POOL_BUFFER;
+static uint16_t *pool_[NUM_POOL_BUFFERS];
+static QueueHandle_t free_ = nullptr;
+
+// Color transfers complete in the order they were queued, so this ring
+// remembers which pool buffer (or -1 for anything else) each queued one
+// sends, and for transfers that are part of a presented frame, the time by
+// which they have to be done for the frame not to be late. Pushing and
+// queueing happen together under transfer_mutex_, the done callback pops.
+struct Queued {
+    int index;
+    int frame;
+    int64_t deadline_us;
+};
+static constexpr int MAX_QUEUED = 16;
+static Queued queued_[MAX_QUEUED];
+static std::atomic<int> queued_head_{0};
+static std::atomic<int> queued_tail_{0};
+static std::mutex transfer_mutex_;
+
+static int pool_index(const void *data) {
+    for (int i = 0; i < NUM_POOL_BUFFERS; i++) {
+        if (data == pool_[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// the frame lcd_wait_vsync() last started, and the one the current window
+// belongs to (no deadline if it wasn't started by lcd_wait_vsync())
+static int next_frame_ = 0;
+static int64_t next_deadline_us_ = INT64_MAX;
+static int window_frame_ = 0;
+static int64_t window_deadline_us_ = INT64_MAX;
+
+// stats, reset each time they are printed
+static std::atomic<int> presented_{0};
+static std::atomic<int> late_{0};
+static std::atomic<int64_t> vsync_wait_us_{0};
+static int last_late_frame_ = -1;
+
+static void push_queued(int index, int frame = 0, int64_t deadline_us = INT64_MAX) {
+    int tail = queued_tail_;
+    queued_[tail % MAX_QUEUED] = {.index = index, .frame = frame, .deadline_us = deadline_us};
+    queued_tail_ = tail + 1;
+}
+
+static bool IRAM_ATTR on_color_trans_done(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_io_event_data_t *edata, void *user_ctx) {
+    int head = queued_head_;
+    if (head == queued_tail_) {
+        return false;
+    }
+    Queued done = queued_[head % MAX_QUEUED];
+    queued_head_ = head + 1;
+    // still being written when the next refresh started
+    if (esp_timer_get_time() > done.deadline_us && done.frame != last_late_frame_) {
+        last_late_frame_ = done.frame;
+        late_++;
+    }
+    BaseType_t woken = pdFALSE;
+    if (done.index >= 0) {
+        xQueueSendFromISR(free_, &done.index, &woken);
+    }
+    return woken == pdTRUE;
+}
+
 static void lvgl_flush_cb(lv_disp_drv_t *drv, const lv_area_t *area, lv_color_t *color_map)
 {
     uint16_t offsetx1 = area->x1;
     uint16_t offsetx2 = area->x2;
     uint16_t offsety1 = area->y1;
     uint16_t offsety2 = area->y2;
+#if !LV_COLOR_16_SWAP
+    // the bus sends colors as they are in memory (see make_color), so
+    // LVGL's colors have to be swapped here
+    size_t num_pixels = (offsetx2 - offsetx1 + 1) * (offsety2 - offsety1 + 1);
+    uint16_t *pixels = (uint16_t*)color_map;
+    for (size_t i = 0; i < num_pixels; i++) {
+        pixels[i] = (pixels[i] >> 8) | (pixels[i] << 8);
+    }
+#endif
     // copy a buffer's content to a specific area of the display
-    esp_lcd_panel_draw_bitmap(panel_handle, offsetx1, offsety1, offsetx2 + 1, offsety2 + 1, color_map);
+    {
+        std::lock_guard<std::mutex> lock(transfer_mutex_);
+        // LVGL draws into the same memory, but its buffers aren't the pool's
+        push_queued(-1);
+        esp_lcd_panel_draw_bitmap(panel_handle, offsetx1, offsety1, offsetx2 + 1, offsety2 + 1, color_map);
+    }
     lv_disp_flush_ready(drv);
 }
 
 void display_clear() {
-    static uint16_t color_data[max_transfer_size / 16];
-    memset(color_data, 0x0000, max_transfer_size / 16 * sizeof(uint16_t));
-    // needs 2 draws to blank for some reason?
-    esp_lcd_panel_draw_bitmap(panel_handle, 0, 0, LCD_H_RES, LCD_V_RES - 100, (lv_color_t*)color_data);
-    esp_lcd_panel_draw_bitmap(panel_handle, 0, 100, LCD_H_RES, LCD_V_RES, (lv_color_t*)color_data);
-}
-
-extern "C" uint16_t make_color(uint8_t r, uint8_t g, uint8_t b) {
-    return lv_color_make(r,g,b).full;
+    static constexpr int clear_lines = 16;
+    static uint16_t color_data[LCD_H_RES * clear_lines] = {0};
+    lcd_begin_window(0, 0, LCD_H_RES, LCD_V_RES);
+    for (int y = 0; y < LCD_V_RES; y += clear_lines) {
+        lcd_write_window((const uint8_t*)color_data, sizeof(color_data));
+    }
 }
 
 extern "C" uint16_t* get_vram0() {
@@ -88,12 +192,95 @@ extern "C" uint8_t* get_frame_buffer1() {
     return frame_buffer1;
 }
 
+// stats, reset each time they are printed
+static std::atomic<size_t> bytes_sent_{0};
+static std::atomic<int> windows_{0};
+static std::atomic<int> buffers_{0};
+static std::atomic<int64_t> stall_us_{0};
+static int64_t stats_start_us_ = 0;
+
+extern "C" uint16_t* lcd_get_buffer() {
+    int index;
+    int64_t start = esp_timer_get_time();
+    xQueueReceive(free_, &index, portMAX_DELAY);
+    stall_us_ += esp_timer_get_time() - start;
+    buffers_++;
+    return pool_[index];
+}
+
 extern "C" void lcd_write_frame(const uint16_t xs, const uint16_t ys, const uint16_t width, const uint16_t height, const uint8_t * data){
     if(data) {
         //esp_lcd_panel_handle_t panel_handle = (esp_lcd_panel_handle_t) disp_drv.user_data;
         //esp_lcd_panel_draw_bitmap(panel_handle, xs, ys, xs + width, ys + height, (lv_color_t*)data);
+        std::lock_guard<std::mutex> lock(transfer_mutex_);
+        push_queued(pool_index(data));
         esp_lcd_panel_draw_bitmap(panel_handle, xs, ys, xs + width, ys + height, (lv_color_t*)data);
+        bytes_sent_ += width * height * sizeof(uint16_t);
+    }
+}
+
+// guarded by transfer_mutex_, like the rest of the window state
+static bool window_started = false;
+
+extern "C" void lcd_begin_window(const uint16_t xs, const uint16_t ys, const uint16_t width, const uint16_t height) {
+    uint16_t xe = xs + width - 1;
+    uint16_t ye = ys + height - 1;
+    uint8_t columns[] = {(uint8_t)(xs >> 8), (uint8_t)(xs & 0xFF), (uint8_t)(xe >> 8), (uint8_t)(xe & 0xFF)};
+    uint8_t rows[] = {(uint8_t)(ys >> 8), (uint8_t)(ys & 0xFF), (uint8_t)(ye >> 8), (uint8_t)(ye & 0xFF)};
+    std::lock_guard<std::mutex> lock(transfer_mutex_);
+    esp_lcd_panel_io_tx_param(io_handle, LCD_CMD_CASET, columns, sizeof(columns));
+    esp_lcd_panel_io_tx_param(io_handle, LCD_CMD_RASET, rows, sizeof(rows));
+    window_started = false;
+    window_frame_ = next_frame_;
+    window_deadline_us_ = next_deadline_us_;
+    next_deadline_us_ = INT64_MAX;
+    windows_++;
+}
+
+extern "C" void lcd_write_window(const uint8_t *data, size_t num_bytes) {
+    std::lock_guard<std::mutex> lock(transfer_mutex_);
+    // only the first write goes back to the top left of the window
+    int cmd = window_started ? LCD_CMD_RAMWRC : LCD_CMD_RAMWR;
+    window_started = true;
+    push_queued(pool_index(data), window_frame_, window_deadline_us_);
+    esp_lcd_panel_io_tx_color(io_handle, cmd, data, num_bytes);
+    bytes_sent_ += num_bytes;
+}
+
+extern "C" void lcd_wait_vsync() {
+    int64_t now = esp_timer_get_time();
+    int64_t since = (now - vsync_origin_us_) % VSYNC_PERIOD_US;
+    int64_t vsync = now - since;
+    if (since > VSYNC_SLACK_US) {
+        vsync += VSYNC_PERIOD_US;
+        vTaskDelay(pdMS_TO_TICKS((vsync - now + 999) / 1000));
+        vsync_wait_us_ += esp_timer_get_time() - now;
     }
+    presented_++;
+    // the frame is late if any of it is still going out after the next one
+    next_frame_++;
+    next_deadline_us_ = vsync + VSYNC_PERIOD_US;
+}
+
+extern "C" void lcd_print_stats() {
+    int64_t now = esp_timer_get_time();
+    float seconds = (now - stats_start_us_) / 1e6f;
+    if (stats_start_us_ && seconds > 0) {
+        // the bus is 8 bits wide, so it moves one byte per pixel clock
+        float bytes_per_second = bytes_sent_ / seconds;
+        fmt::print("lcd: {:.2f} MB/s ({:.0f}% of the bus), {} windows, waited {} us for {} buffers, "
+                   "presented {} frames ({} late), waited {} us for vsync\n",
+                   bytes_per_second / 1e6f, 100.0f * bytes_per_second / LCD_PIXEL_CLOCK_HZ, (int)windows_,
+                   (int64_t)stall_us_, (int)buffers_, (int)presented_, (int)late_, (int64_t)vsync_wait_us_);
+    }
+    stats_start_us_ = now;
+    bytes_sent_ = 0;
+    windows_ = 0;
+    buffers_ = 0;
+    stall_us_ = 0;
+    presented_ = 0;
+    late_ = 0;
+    vsync_wait_us_ = 0;
 }
 
 static bool initialized = false;
@@ -145,11 +332,11 @@ extern "C" void lcd_init() {
         .sram_trans_align = 4,
     };
     ESP_ERROR_CHECK(esp_lcd_new_i80_bus(&bus_config, &i80_bus));
-    esp_lcd_panel_io_handle_t io_handle = NULL;
     esp_lcd_panel_io_i80_config_t io_config = {
         .cs_gpio_num = PIN_DISP_CS,
         .pclk_hz = LCD_PIXEL_CLOCK_HZ,
         .trans_queue_depth = 10,
+        .on_color_trans_done = on_color_trans_done,
         .user_ctx = &disp_drv,
         .lcd_cmd_bits = LCD_CMD_BITS,
         .lcd_param_bits = LCD_PARAM_BITS,
@@ -160,7 +347,9 @@ extern "C" void lcd_init() {
             .dc_data_level = 1,
         },
         .flags = {
-            .swap_color_bytes = !LV_COLOR_16_SWAP, // Swap can be done in LvGL (default) or DMA
+            // emulator frames are built in panel byte order, and LVGL's are
+            // swapped in lvgl_flush_cb if it doesn't do it itself
+            .swap_color_bytes = false,
         },
     };
     ESP_ERROR_CHECK(esp_lcd_new_panel_io_i80(i80_bus, &io_config, &io_handle));
@@ -182,6 +371,10 @@ extern "C" void lcd_init() {
 
     // user can flush pre-defined pattern to the screen before we turn on the screen or backlight
     ESP_ERROR_CHECK(esp_lcd_panel_disp_on_off(panel_handle, true));
+    // refresh at a known rate, so vsync can be estimated from here on
+    uint8_t frame_rate[] = {LCD_FRCTRL2_60HZ};
+    esp_lcd_panel_io_tx_param(io_handle, LCD_CMD_FRCTRL2, frame_rate, sizeof(frame_rate));
+    vsync_origin_us_ = esp_timer_get_time();
 
     esp_lcd_panel_swap_xy(panel_handle, true);
     esp_lcd_panel_mirror(panel_handle, false, true);
@@ -201,6 +394,13 @@ extern "C" void lcd_init() {
             .log_level = espp::Logger::Verbosity::WARN,
         });
 
+    free_ = xQueueCreate(NUM_POOL_BUFFERS, sizeof(int));
+    for (int i = 0; i < NUM_POOL_BUFFERS; i++) {
+        uint16_t *vram = i < NUM_POOL_BUFFERS / 2 ? display->vram0() : display->vram1();
+        pool_[i] = vram + (i % (NUM_POOL_BUFFERS / 2)) * LCD_H_RES * NUM_ROWS_IN_POOL_BUFFER;
+        xQueueSend(free_, &i, 0);
+    }
+
     frame_buffer0 = (uint8_t*)heap_caps_malloc(frame_buffer_size, MALLOC_CAP_8BIT);
     frame_buffer1 = (uint8_t*)heap_caps_malloc(frame_buffer_size, MALLOC_CAP_8BIT);
 
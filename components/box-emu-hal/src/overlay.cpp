@@ -0,0 +1,207 @@
+#include "overlay.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#include "i80_lcd.h"
+
+/**
+ * Sprites are pre-rendered in panel byte order when what they show changes,
+ * compositing is then only copies into the lines that cross them. Two
+ * values that are never drawn stand for "leave the game's pixel" and "darken
+ * the game's pixel", which gives the sprites a see-through backdrop.
+ */
+
+static constexpr uint16_t CLEAR = 0x0100;
+static constexpr uint16_t SHADE = 0x0200;
+// how long the volume bar and save icon stay up
+static constexpr int64_t SHOW_US = 1500 * 1000;
+static constexpr int64_t FPS_PERIOD_US = 1000 * 1000;
+// from the edges of the window
+static constexpr int MARGIN = 4;
+#if CONFIG_OVERLAY_SHOW_FPS
+static constexpr bool SHOW_FPS = true;
+#else
+static constexpr bool SHOW_FPS = false;
+#endif
+
+struct Sprite {
+  int width;
+  int height;
+  uint16_t *pixels;
+};
+
+static constexpr int VOLUME_BAR_WIDTH = 100;
+static uint16_t volume_pixels_[(VOLUME_BAR_WIDTH + 8) * 14];
+static Sprite volume_sprite_ = {.width = VOLUME_BAR_WIDTH + 8, .height = 14, .pixels = volume_pixels_};
+static uint16_t saved_pixels_[20 * 20];
+static Sprite saved_sprite_ = {.width = 20, .height = 20, .pixels = saved_pixels_};
+static constexpr int MAX_FPS_DIGITS = 3;
+static uint16_t fps_pixels_[(4 + MAX_FPS_DIGITS * 8) * 14];
+static Sprite fps_sprite_ = {.width = 4 + MAX_FPS_DIGITS * 8, .height = 14, .pixels = fps_pixels_};
+
+// 3x5 digits, a row per 3 bits from the top
+static const uint16_t DIGITS[10] = {
+  0b111101101101111, 0b010110010010111, 0b111001111100111, 0b111001111001111,
+  0b101101111001001, 0b111100111001111, 0b111100111101111, 0b111001001001001,
+  0b111101111101111, 0b111101111001111,
+};
+
+// 8x8 floppy disk
+static const uint8_t SAVED_ICON[8] = {
+  0b11111110, 0b10011011, 0b10011011, 0b10000001,
+  0b10111101, 0b10100101, 0b10111101, 0b11111111,
+};
+
+// set from any task
+static std::atomic<int> volume_{0};
+static std::atomic<bool> volume_changed_{false};
+static std::atomic<bool> saved_{false};
+
+// video task only
+static int drawn_volume_ = -1;
+static bool saved_drawn_ = false;
+static int64_t volume_until_us_ = 0;
+static int64_t saved_until_us_ = 0;
+static int fps_frames_ = 0;
+static int64_t fps_start_us_ = 0;
+static bool fps_drawn_ = false;
+// what is up for the frame being sent
+static bool show_volume_ = false;
+static bool show_saved_ = false;
+static bool show_fps_ = false;
+
+static void fill(Sprite &sprite, int x, int y, int width, int height, uint16_t color) {
+  for (int j = y; j < y + height; j++) {
+    std::fill_n(&sprite.pixels[j * sprite.width + x], width, color);
+  }
+}
+
+static void draw_volume(int percent) {
+  fill(volume_sprite_, 0, 0, volume_sprite_.width, volume_sprite_.height, SHADE);
+  int level = std::clamp(percent, 0, 100) * VOLUME_BAR_WIDTH / 100;
+  fill(volume_sprite_, 4, 4, level, 6, make_color(255, 255, 255));
+  fill(volume_sprite_, 4 + level, 4, VOLUME_BAR_WIDTH - level, 6, make_color(64, 64, 64));
+}
+
+static void draw_saved() {
+  fill(saved_sprite_, 0, 0, saved_sprite_.width, saved_sprite_.height, SHADE);
+  uint16_t color = make_color(255, 255, 255);
+  for (int y = 0; y < 8; y++) {
+    for (int x = 0; x < 8; x++) {
+      if (SAVED_ICON[y] & (0x80 >> x)) {
+        fill(saved_sprite_, 2 + 2 * x, 2 + 2 * y, 2, 2, color);
+      }
+    }
+  }
+}
+
+static void draw_fps(int fps) {
+  fps = std::clamp(fps, 0, 999);
+  int num_digits = fps >= 100 ? 3 : fps >= 10 ? 2 : 1;
+  fill(fps_sprite_, 0, 0, fps_sprite_.width, fps_sprite_.height, CLEAR);
+  fill(fps_sprite_, 0, 0, 4 + num_digits * 8 - 2, fps_sprite_.height, SHADE);
+  uint16_t color = make_color(255, 255, 0);
+  for (int d = num_digits - 1; d >= 0; d--) {
+    uint16_t bits = DIGITS[fps % 10];
+    fps /= 10;
+    for (int y = 0; y < 5; y++) {
+      for (int x = 0; x < 3; x++) {
+        if (bits & (1 << (14 - y * 3 - x))) {
+          fill(fps_sprite_, 2 + d * 8 + 2 * x, 2 + 2 * y, 2, 2, color);
+        }
+      }
+    }
+  }
+}
+
+// colors are high byte first in memory
+static inline uint16_t darken(uint16_t color) {
+  return __builtin_bswap16((__builtin_bswap16(color) >> 1) & 0x7BEF);
+}
+
+static void composite(const Sprite &sprite, int sprite_x, int sprite_y,
+                      uint16_t *lines, int first_y, int num_lines, int width) {
+  int y0 = std::max(sprite_y, first_y);
+  int y1 = std::min(sprite_y + sprite.height, first_y + num_lines);
+  int x0 = std::max(sprite_x, 0);
+  int x1 = std::min(sprite_x + sprite.width, width);
+  for (int y = y0; y < y1; y++) {
+    const uint16_t *src = &sprite.pixels[(y - sprite_y) * sprite.width + (x0 - sprite_x)];
+    uint16_t *dst = &lines[(y - first_y) * width + x0];
+    for (int x = 0; x < x1 - x0; x++) {
+      uint16_t pixel = src[x];
+      if (pixel == SHADE) {
+        dst[x] = darken(dst[x]);
+      } else if (pixel != CLEAR) {
+        dst[x] = pixel;
+      }
+    }
+  }
+}
+
+// picks what is up for the frame that is starting, and redraws what changed
+static void begin_frame() {
+  int64_t now = esp_timer_get_time();
+  // the timers start when the sprites first make it to the screen, a save
+  // happens while the menu is up
+  if (volume_changed_.exchange(false)) {
+    int volume = volume_;
+    if (volume != drawn_volume_) {
+      draw_volume(volume);
+      drawn_volume_ = volume;
+    }
+    volume_until_us_ = now + SHOW_US;
+  }
+  if (saved_.exchange(false)) {
+    if (!saved_drawn_) {
+      draw_saved();
+      saved_drawn_ = true;
+    }
+    saved_until_us_ = now + SHOW_US;
+  }
+  show_volume_ = now < volume_until_us_;
+  show_saved_ = now < saved_until_us_;
+  if (SHOW_FPS) {
+    fps_frames_++;
+    int64_t elapsed = now - fps_start_us_;
+    if (elapsed >= FPS_PERIOD_US) {
+      if (fps_start_us_) {
+        draw_fps((fps_frames_ * 1000000 + elapsed / 2) / elapsed);
+        fps_drawn_ = true;
+      }
+      fps_start_us_ = now;
+      fps_frames_ = 0;
+    }
+    show_fps_ = fps_drawn_;
+  }
+}
+
+extern "C" void overlay_show_volume(int percent) {
+  volume_ = percent;
+  volume_changed_ = true;
+}
+
+extern "C" void overlay_show_saved() {
+  saved_ = true;
+}
+
+extern "C" void overlay_draw(uint16_t *lines, int first_y, int num_lines, int width, int height) {
+  if (first_y == 0) {
+    begin_frame();
+  }
+  if (show_fps_) {
+    composite(fps_sprite_, MARGIN, MARGIN, lines, first_y, num_lines, width);
+  }
+  if (show_saved_) {
+    composite(saved_sprite_, width - saved_sprite_.width - MARGIN, MARGIN,
+              lines, first_y, num_lines, width);
+  }
+  if (show_volume_) {
+    composite(volume_sprite_, (width - volume_sprite_.width) / 2, height - volume_sprite_.height - MARGIN,
+              lines, first_y, num_lines, width);
+  }
+}
@@ -0,0 +1,425 @@
+#include "rewind.h"
+
+#include <algorithm>
+#include <atomic>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+#include "format.hpp"
+
+/**
+ * Rewind keeps a ring of emulator snapshots in PSRAM. Every
+ * CAPTURE_INTERVAL_FRAMES frames the emulator is serialized into a scratch
+ * buffer; every KEYFRAME_INTERVAL captures that snapshot becomes the new
+ * keyframe, otherwise it is stored as the XOR against the current keyframe.
+ * Either way the result is run length encoded (runs of zeros / literals), so
+ * the mostly-unchanged deltas end up at a few KB each.
+ *
+ * Only taking the snapshot has to happen within a single frame. Encoding is
+ * done in ENCODE_SLICE_SIZE slices spread over the following frames, with
+ * the number of slices per frame chosen from the measured slice cost so that
+ * the work done per frame stays under FRAME_BUDGET_US.
+ */
+
+// one snapshot per second of emulated time
+static constexpr int CAPTURE_INTERVAL_FRAMES = 60;
+static constexpr int KEYFRAME_INTERVAL = 8;
+// while rewind is held, step back one snapshot this often (~6x speed)
+static constexpr int RESTORE_INTERVAL_FRAMES = 10;
+
+static constexpr size_t RING_SIZE = 512 * 1024;
+static constexpr int MAX_ENTRIES = 512;
+
+static constexpr size_t ENCODE_SLICE_SIZE = 4 * 1024;
+static constexpr int FRAME_BUDGET_US = 1000;
+// zero runs shorter than this are cheaper to leave in the literal
+static constexpr size_t MIN_ZERO_RUN = 4;
+static constexpr size_t TOKEN_HEADER_SIZE = 4;
+
+struct Entry {
+  uint32_t offset;
+  uint32_t size;
+  uint32_t state_size;
+  uint32_t key_seq;
+  bool keyframe;
+};
+
+static rewind_save_fn save_ = nullptr;
+static rewind_load_fn load_ = nullptr;
+
+static uint8_t *ring_ = nullptr;
+static uint8_t *state_ = nullptr;   // last snapshot, input to the encoder
+static uint8_t *key_ = nullptr;     // decoded current keyframe
+static uint8_t *encoded_ = nullptr; // encoder output before it goes into the ring
+static size_t capacity_ = 0;
+
+static Entry entries_[MAX_ENTRIES];
+static int oldest_ = 0;
+static int count_ = 0;
+static size_t write_pos_ = 0;
+static size_t bytes_used_ = 0;
+
+static uint32_t next_seq_ = 0;
+static uint32_t key_seq_ = 0;
+static bool key_valid_ = false;
+static int captures_since_key_ = 0;
+static int frames_since_capture_ = 0;
+static int frames_until_restore_ = 0;
+
+// in-progress encode
+static bool encoding_ = false;
+static bool encoding_keyframe_ = false;
+static size_t state_size_ = 0;
+static size_t encode_pos_ = 0;
+static size_t encoded_size_ = 0;
+
+static std::atomic<bool> active_{false};
+
+// stats, reset each time they are printed
+static int64_t slice_us_ = 50;
+static int64_t frame_us_total_ = 0;
+static int64_t frame_us_max_ = 0;
+static int64_t snapshot_us_max_ = 0;
+static int64_t restore_us_max_ = 0;
+static int stat_frames_ = 0;
+static size_t last_delta_size_ = 0;
+static int restores_ = 0;
+
+static Entry &entry_at(int i) {
+  return entries_[(oldest_ + i) % MAX_ENTRIES];
+}
+
+static void drop_oldest() {
+  Entry &e = entry_at(0);
+  if (e.keyframe && e.key_seq == key_seq_) {
+    // deltas against this keyframe could no longer be decoded
+    key_valid_ = false;
+  }
+  bytes_used_ -= e.size;
+  oldest_ = (oldest_ + 1) % MAX_ENTRIES;
+  --count_;
+}
+
+static void drop_newest() {
+  Entry &e = entry_at(count_ - 1);
+  if (e.keyframe && e.key_seq == key_seq_) {
+    key_valid_ = false;
+  }
+  bytes_used_ -= e.size;
+  write_pos_ = e.offset;
+  --count_;
+}
+
+static bool overlaps(const Entry &e, size_t start, size_t size) {
+  return e.offset < start + size && start < e.offset + e.size;
+}
+
+// make room for size bytes at the write position, evicting the oldest
+// entries (and any deltas left without their keyframe)
+static size_t ring_alloc(size_t size) {
+  if (write_pos_ + size > RING_SIZE) {
+    // everything still in the tail is older than what is at the start
+    while (count_ && entry_at(0).offset >= write_pos_) {
+      drop_oldest();
+    }
+    write_pos_ = 0;
+  }
+  while (count_ && (count_ == MAX_ENTRIES || overlaps(entry_at(0), write_pos_, size))) {
+    drop_oldest();
+  }
+  while (count_ && !entry_at(0).keyframe) {
+    drop_oldest();
+  }
+  size_t offset = write_pos_;
+  write_pos_ += size;
+  return offset;
+}
+
+static inline uint8_t delta(const uint8_t *src, const uint8_t *key, size_t i) {
+  return key ? src[i] ^ key[i] : src[i];
+}
+
+// encode len bytes of src (xor key, if given) as
+// [u16 zero run][u16 literal length][literal bytes]... tokens.
+// Output is at most len + TOKEN_HEADER_SIZE bytes.
+static size_t encode_slice(const uint8_t *src, const uint8_t *key, size_t len, uint8_t *out) {
+  size_t i = 0;
+  size_t o = 0;
+  while (i < len) {
+    size_t zeros = 0;
+    while (i < len && delta(src, key, i) == 0) {
+      ++zeros;
+      ++i;
+    }
+    size_t start = i;
+    size_t zero_run = 0;
+    while (i < len) {
+      if (delta(src, key, i) == 0) {
+        if (++zero_run == MIN_ZERO_RUN) {
+          i -= MIN_ZERO_RUN - 1;
+          break;
+        }
+      } else {
+        zero_run = 0;
+      }
+      ++i;
+    }
+    size_t literal = i - start;
+    out[o++] = zeros & 0xff;
+    out[o++] = zeros >> 8;
+    out[o++] = literal & 0xff;
+    out[o++] = literal >> 8;
+    for (size_t j = start; j < i; j++) {
+      out[o++] = delta(src, key, j);
+    }
+  }
+  return o;
+}
+
+static bool decode(const uint8_t *in, size_t in_size, const uint8_t *key, uint8_t *dst, size_t len) {
+  size_t i = 0;
+  size_t o = 0;
+  while (o < len) {
+    if (i + TOKEN_HEADER_SIZE > in_size) {
+      return false;
+    }
+    size_t zeros = in[i] | (in[i+1] << 8);
+    size_t literal = in[i+2] | (in[i+3] << 8);
+    i += TOKEN_HEADER_SIZE;
+    if (o + zeros + literal > len || i + literal > in_size) {
+      return false;
+    }
+    if (key) {
+      memcpy(&dst[o], &key[o], zeros);
+    } else {
+      memset(&dst[o], 0, zeros);
+    }
+    o += zeros;
+    for (size_t j = 0; j < literal; j++, o++) {
+      dst[o] = key ? in[i+j] ^ key[o] : in[i+j];
+    }
+    i += literal;
+  }
+  return true;
+}
+
+static void start_capture() {
+  state_size_ = save_(state_, capacity_);
+  if (state_size_ == 0) {
+    return;
+  }
+  encoding_ = true;
+  encoding_keyframe_ = !key_valid_ || captures_since_key_ >= KEYFRAME_INTERVAL;
+  if (encoding_keyframe_) {
+    // key_ gets overwritten as the new keyframe is encoded
+    key_valid_ = false;
+  }
+  encode_pos_ = 0;
+  encoded_size_ = 0;
+}
+
+static void finish_capture() {
+  encoding_ = false;
+  if (encoded_size_ > RING_SIZE) {
+    return;
+  }
+  if (encoding_keyframe_) {
+    // key_ was filled slice by slice while encoding, clear whatever is left
+    // over from a larger previous keyframe so deltas stay well defined
+    memset(&key_[state_size_], 0, capacity_ - state_size_);
+    key_seq_ = next_seq_++;
+    key_valid_ = true;
+    captures_since_key_ = 0;
+  }
+  size_t offset = ring_alloc(encoded_size_);
+  if (!key_valid_) {
+    // our own keyframe was evicted to make room, nothing to attach to
+    write_pos_ = offset;
+    return;
+  }
+  memcpy(&ring_[offset], encoded_, encoded_size_);
+  Entry &e = entries_[(oldest_ + count_) % MAX_ENTRIES];
+  e.offset = offset;
+  e.size = encoded_size_;
+  e.state_size = state_size_;
+  e.key_seq = key_seq_;
+  e.keyframe = encoding_keyframe_;
+  ++count_;
+  bytes_used_ += encoded_size_;
+  ++captures_since_key_;
+  last_delta_size_ = encoded_size_;
+}
+
+static void encode_some() {
+  int slices = std::max<int>(1, FRAME_BUDGET_US / std::max<int64_t>(slice_us_, 1));
+  int64_t start = esp_timer_get_time();
+  int done = 0;
+  for (; done < slices && encode_pos_ < state_size_; done++) {
+    size_t len = std::min(ENCODE_SLICE_SIZE, state_size_ - encode_pos_);
+    const uint8_t *src = &state_[encode_pos_];
+    if (encoding_keyframe_) {
+      encoded_size_ += encode_slice(src, nullptr, len, &encoded_[encoded_size_]);
+      memcpy(&key_[encode_pos_], src, len);
+    } else {
+      encoded_size_ += encode_slice(src, &key_[encode_pos_], len, &encoded_[encoded_size_]);
+    }
+    encode_pos_ += len;
+  }
+  if (done) {
+    slice_us_ = (slice_us_ * 7 + (esp_timer_get_time() - start) / done) / 8;
+  }
+  if (encode_pos_ >= state_size_) {
+    finish_capture();
+  }
+}
+
+// returns whether the emulator was put back to a snapshot
+static bool restore_newest() {
+  if (count_ == 0) {
+    return false;
+  }
+  Entry e = entry_at(count_ - 1);
+  if (!e.keyframe && !(key_valid_ && key_seq_ == e.key_seq)) {
+    // need to decode the keyframe this delta was made against first
+    int k = count_ - 1;
+    while (k >= 0 && !(entry_at(k).keyframe && entry_at(k).key_seq == e.key_seq)) {
+      --k;
+    }
+    if (k < 0) {
+      drop_newest();
+      return false;
+    }
+    const Entry &kf = entry_at(k);
+    if (!decode(&ring_[kf.offset], kf.size, nullptr, key_, kf.state_size)) {
+      drop_newest();
+      return false;
+    }
+    memset(&key_[kf.state_size], 0, capacity_ - kf.state_size);
+    key_seq_ = kf.key_seq;
+    key_valid_ = true;
+  }
+  const uint8_t *key = e.keyframe ? nullptr : key_;
+  bool restored = decode(&ring_[e.offset], e.size, key, state_, e.state_size) &&
+    load_(state_, e.state_size);
+  if (restored) {
+    ++restores_;
+  }
+  drop_newest();
+  // the next delta has to go against whichever keyframe is now newest
+  captures_since_key_ = 0;
+  for (int i = count_ - 1; i >= 0 && entry_at(i).key_seq == key_seq_; i--) {
+    ++captures_since_key_;
+  }
+  return restored;
+}
+
+static void free_buffers() {
+  heap_caps_free(state_);
+  heap_caps_free(key_);
+  heap_caps_free(encoded_);
+  state_ = key_ = encoded_ = nullptr;
+  capacity_ = 0;
+}
+
+extern "C" void rewind_init(size_t max_state_size, rewind_save_fn save, rewind_load_fn load) {
+  save_ = save;
+  load_ = load;
+  if (!ring_) {
+    ring_ = (uint8_t*)heap_caps_malloc(RING_SIZE, MALLOC_CAP_8BIT | MALLOC_CAP_SPIRAM);
+  }
+  if (capacity_ != max_state_size) {
+    free_buffers();
+    size_t num_slices = (max_state_size + ENCODE_SLICE_SIZE - 1) / ENCODE_SLICE_SIZE;
+    state_ = (uint8_t*)heap_caps_malloc(max_state_size, MALLOC_CAP_8BIT | MALLOC_CAP_SPIRAM);
+    key_ = (uint8_t*)heap_caps_calloc(1, max_state_size, MALLOC_CAP_8BIT | MALLOC_CAP_SPIRAM);
+    encoded_ = (uint8_t*)heap_caps_malloc(max_state_size + num_slices * TOKEN_HEADER_SIZE,
+                                          MALLOC_CAP_8BIT | MALLOC_CAP_SPIRAM);
+    capacity_ = max_state_size;
+  }
+  if (!ring_ || !state_ || !key_ || !encoded_) {
+    fmt::print(fg(fmt::terminal_color::red), "ERROR: Couldn't allocate memory for rewind, disabling it\n");
+    free_buffers();
+  }
+  rewind_reset();
+}
+
+extern "C" void rewind_reset() {
+  oldest_ = 0;
+  count_ = 0;
+  write_pos_ = 0;
+  bytes_used_ = 0;
+  key_valid_ = false;
+  captures_since_key_ = 0;
+  frames_since_capture_ = 0;
+  frames_until_restore_ = 0;
+  encoding_ = false;
+}
+
+extern "C" void rewind_deinit() {
+  rewind_reset();
+  save_ = nullptr;
+  load_ = nullptr;
+}
+
+extern "C" void rewind_set_active(bool active) {
+  active_ = active;
+}
+
+extern "C" bool rewind_is_active() {
+  return active_;
+}
+
+extern "C" bool rewind_update() {
+  if (!save_ || !load_ || !capacity_) {
+    return true;
+  }
+  int64_t start = esp_timer_get_time();
+  // the frame is emulated unless rewind is held, then only the one after
+  // each restore is, to show the snapshot that was gone back to
+  bool run_frame = true;
+  if (active_) {
+    // whatever was being encoded is newer than where we are going
+    encoding_ = false;
+    frames_since_capture_ = 0;
+    run_frame = false;
+    if (--frames_until_restore_ <= 0) {
+      frames_until_restore_ = RESTORE_INTERVAL_FRAMES;
+      run_frame = restore_newest();
+      restore_us_max_ = std::max(restore_us_max_, esp_timer_get_time() - start);
+    }
+  } else {
+    frames_until_restore_ = 0;
+    if (encoding_) {
+      encode_some();
+    } else if (++frames_since_capture_ >= CAPTURE_INTERVAL_FRAMES) {
+      frames_since_capture_ = 0;
+      start_capture();
+      snapshot_us_max_ = std::max(snapshot_us_max_, esp_timer_get_time() - start);
+    }
+  }
+  int64_t elapsed = esp_timer_get_time() - start;
+  frame_us_total_ += elapsed;
+  frame_us_max_ = std::max(frame_us_max_, elapsed);
+  ++stat_frames_;
+  return run_frame;
+}
+
+extern "C" void rewind_print_stats() {
+  if (!capacity_) {
+    return;
+  }
+  fmt::print("rewind: {} snapshots ({}s), {}/{} KB, last {} B, "
+             "frame cost avg {}us max {}us (snapshot {}us, restore {}us), {} restores\n",
+             count_, count_ * CAPTURE_INTERVAL_FRAMES / 60,
+             bytes_used_ / 1024, RING_SIZE / 1024, last_delta_size_,
+             stat_frames_ ? frame_us_total_ / stat_frames_ : 0,
+             frame_us_max_, snapshot_us_max_, restore_us_max_, restores_);
+  frame_us_total_ = 0;
+  frame_us_max_ = 0;
+  snapshot_us_max_ = 0;
+  restore_us_max_ = 0;
+  stat_frames_ = 0;
+  restores_ = 0;
+}
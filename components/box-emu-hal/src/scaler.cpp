@@ -0,0 +1,165 @@
+#include "scaler.h"
+
+#include <algorithm>
+#include <math.h>
+
+/**
+ * Blending works on a color spread out into a 32 bit word with room above
+ * each channel,
+ *
+ *   00000gggggg00000rrrrr000000bbbbb
+ *
+ * so all three channels are weighted with one multiply each. With weights
+ * adding up to 32 no channel spills into the next.
+ */
+
+static constexpr int WEIGHT_ONE = 32;
+static constexpr int WEIGHT_SHIFT = 5;
+static constexpr uint32_t SPREAD_MASK = 0x07E0F81F;
+
+static inline uint32_t spread(uint16_t color) {
+  // colors are high byte first in memory
+  uint32_t c = __builtin_bswap16(color);
+  return (c | (c << 16)) & SPREAD_MASK;
+}
+
+static inline uint16_t unspread(uint32_t c) {
+  c &= SPREAD_MASK;
+  return __builtin_bswap16((uint16_t)(c | (c >> 16)));
+}
+
+static inline uint32_t blend(uint32_t a, uint32_t b, int weight) {
+  return ((a * (WEIGHT_ONE - weight) + b * weight) >> WEIGHT_SHIFT) & SPREAD_MASK;
+}
+
+// Source pixel (and the weight of the one after it) for every output pixel
+// along one axis. Pixel centers are at +0.5, sampling a source pixel's
+// center gives a weight of 0.
+static void build_axis(uint16_t *index, uint8_t *weight, int src, int dst, ScalerFilter filter, bool filtered) {
+  for (int i = 0; i < dst; i++) {
+    if (!filtered) {
+      index[i] = i * src / dst;
+      weight[i] = 0;
+      continue;
+    }
+    float texel = (i + 0.5f) * src / dst;
+    if (filter == SCALER_SHARP_BILINEAR) {
+      // as if the source was first scaled up by the largest integer factor
+      // with nearest, and that bilinearly to the rest: only a band around
+      // each edge between source pixels blends
+      int factor = std::max(dst / src, 1);
+      float texel_floor = floorf(texel);
+      float center_dist = texel - texel_floor - 0.5f;
+      float range = 0.5f - 0.5f / factor;
+      texel = texel_floor + (center_dist - std::clamp(center_dist, -range, range)) * factor + 0.5f;
+    }
+    float pos = texel - 0.5f;
+    int first = (int)floorf(pos);
+    int w = (int)lroundf((pos - first) * WEIGHT_ONE);
+    if (w == WEIGHT_ONE) {
+      first++;
+      w = 0;
+    }
+    if (first < 0) {
+      first = 0;
+      w = 0;
+    }
+    if (first >= src - 1) {
+      first = src - 1;
+      w = 0;
+    }
+    index[i] = first;
+    weight[i] = w;
+  }
+}
+
+extern "C" void scaler_init(Scaler *scaler, int src_width, int src_height,
+                            int dst_width, int dst_height, ScalerFilter filter) {
+  if (scaler->src_width == src_width && scaler->src_height == src_height &&
+      scaler->dst_width == dst_width && scaler->dst_height == dst_height &&
+      scaler->filter == filter) {
+    return;
+  }
+  dst_width = std::min(dst_width, SCALER_MAX_WIDTH);
+  dst_height = std::min(dst_height, SCALER_MAX_HEIGHT);
+  build_axis(scaler->x_index, scaler->x_weight, src_width, dst_width, filter,
+             filter != SCALER_NEAREST);
+  build_axis(scaler->y_index, scaler->y_weight, src_height, dst_height, filter,
+             filter == SCALER_SHARP_BILINEAR);
+  scaler->src_width = src_width;
+  scaler->src_height = src_height;
+  scaler->dst_width = dst_width;
+  scaler->dst_height = dst_height;
+  scaler->filter = filter;
+}
+
+extern "C" int scaler_lines_needed(const Scaler *scaler, int dst_y) {
+  return scaler->y_index[dst_y] + (scaler->y_weight[dst_y] ? 2 : 1);
+}
+
+// fetch(row, x) returns the color of source pixel x on source line row
+template <typename Row, typename Fetch>
+static void scale_line(const Scaler *scaler, uint16_t *dst, Row row0, Row row1, int wy, Fetch &&fetch) {
+  int width = scaler->dst_width;
+  const uint16_t *index = scaler->x_index;
+  const uint8_t *weight = scaler->x_weight;
+  if (scaler->filter == SCALER_NEAREST) {
+    // repeated source pixels are only fetched (and looked up in the
+    // palette) once
+    int last = -1;
+    uint16_t color = 0;
+    for (int x = 0; x < width; x++) {
+      if (index[x] != last) {
+        last = index[x];
+        color = fetch(row0, last);
+      }
+      dst[x] = color;
+    }
+    return;
+  }
+  for (int x = 0; x < width; x++) {
+    int i = index[x];
+    int wx = weight[x];
+    uint32_t c = spread(fetch(row0, i));
+    if (wx) {
+      c = blend(c, spread(fetch(row0, i + 1)), wx);
+    }
+    if (wy) {
+      uint32_t below = spread(fetch(row1, i));
+      if (wx) {
+        below = blend(below, spread(fetch(row1, i + 1)), wx);
+      }
+      c = blend(c, below, wy);
+    }
+    dst[x] = unspread(c);
+  }
+}
+
+extern "C" void scaler_line(const Scaler *scaler, uint16_t *dst, int dst_y,
+                            const uint16_t *frame, int stride) {
+  int y = scaler->y_index[dst_y];
+  int wy = scaler->y_weight[dst_y];
+  const uint16_t *row0 = &frame[y * stride];
+  if (scaler->filter == SCALER_NEAREST) {
+    // a plain copy, nothing to save by skipping repeats
+    for (int x = 0; x < scaler->dst_width; x++) {
+      dst[x] = row0[scaler->x_index[x]];
+    }
+    return;
+  }
+  const uint16_t *row1 = wy ? row0 + stride : row0;
+  scale_line(scaler, dst, row0, row1, wy, [](const uint16_t *row, int x) {
+    return row[x];
+  });
+}
+
+extern "C" void scaler_line_indexed(const Scaler *scaler, uint16_t *dst, int dst_y,
+                                    const uint8_t *frame, int pitch, const uint16_t *palette) {
+  int y = scaler->y_index[dst_y];
+  int wy = scaler->y_weight[dst_y];
+  const uint8_t *row0 = &frame[y * pitch];
+  const uint8_t *row1 = wy ? row0 + pitch : row0;
+  scale_line(scaler, dst, row0, row1, wy, [palette](const uint8_t *row, int x) {
+    return palette[row[x]];
+  });
+}
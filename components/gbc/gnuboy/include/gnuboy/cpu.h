@@ -21,6 +21,7 @@ struct cpu
 	int speed;
 	int halt;
 	int div, tim;
+	int tpend, tdue; /* lazy DIV/TIMA, see cpu.c */
 	int lcdc;
 	int snd;
 };
@@ -34,6 +35,9 @@ int cpu_emulate(int cycles); /* NOTE there may be an ASM version of that */
 
 void div_advance(int cnt);
 void timer_advance(int cnt);
+void timer_schedule();
+void timer_sync();
+void timer_dirty();
 void sound_advance(int cnt);
 
 #endif
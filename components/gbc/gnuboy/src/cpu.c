@@ -255,6 +255,7 @@ void cpu_reset()
 	cpu.halt = 0;
 	cpu.div = 0;
 	cpu.tim = 0;
+	timer_dirty();
 	/* set lcdc ahead of cpu by 19us; see A */
 	/* FIXME: leave value at 0, use lcdc_trans() to actually send lcdc ahead */
 	cpu.lcdc = 40;
@@ -319,6 +320,48 @@ void IRAM_ATTR timer_advance(int cnt)
 	}
 }
 
+/* B:
+	DIV and TIMA are not advanced every instruction. cpu.tpend collects the
+	time (in the units of div_advance/timer_advance) since they were last
+	brought up to date, and cpu.tdue is the value of it at which TIMA
+	overflows next, so timer_sync() only has to run then, or when the
+	registers are accessed. The deadline is capped so cpu.tpend stays small
+	while the timer is off.
+*/
+#define TIMER_MAX_PEND 0x10000
+
+/* recompute cpu.tdue, cpu.tpend must be 0 */
+void IRAM_ATTR timer_schedule()
+{
+	int unit, cnt;
+
+	cpu.tdue = TIMER_MAX_PEND;
+	if (!(R_TAC & 0x04)) return;
+
+	unit = ((-R_TAC) & 3) << 1;
+	cnt = (((256 - R_TIMA) << 9) - cpu.tim + (1<<unit) - 1) >> unit;
+	if (cnt < cpu.tdue)
+		cpu.tdue = cnt;
+}
+
+/* bring DIV and TIMA up to date; see B */
+void IRAM_ATTR timer_sync()
+{
+	int cnt = cpu.tpend;
+
+	cpu.tpend = 0;
+	div_advance(cnt);
+	timer_advance(cnt);
+	timer_schedule();
+}
+
+/* forget pending time after the timer state was replaced (loadstate) */
+void timer_dirty()
+{
+	cpu.tpend = 0;
+	timer_schedule();
+}
+
 /* cnt - time to emulate, expressed in 2MHz units
 	Will call lcdc_trans() if CPU emulation catched up or
 	went ahead of LCDC, so that lcd never falls	behind
@@ -338,8 +381,8 @@ inline void sound_advance(int cnt)
 /* cnt - time to emulate, expressed in 2MHz units */
 void IRAM_ATTR cpu_timers(int cnt)
 {
-	div_advance(cnt << cpu.speed);
-	timer_advance(cnt << cpu.speed);
+	cpu.tpend += cnt << cpu.speed;
+	if (cpu.tpend >= cpu.tdue) timer_sync();
 	lcdc_advance(cnt);
 	sound_advance(cnt);
 }
@@ -353,7 +396,7 @@ void IRAM_ATTR cpu_timers(int cnt)
 /* FIXME: bring cpu_timers() out, make caller advance system */
 int IRAM_ATTR cpu_idle(int max)
 {
-	int cnt, unit;
+	int cnt;
 
 
 	if (!(cpu.halt && IME)) return 0;
@@ -374,10 +417,8 @@ int IRAM_ATTR cpu_idle(int max)
 		return max;
 	}
 
-	/* Figure out when the next timer interrupt will happen */
-	unit = ((-R_TAC) & 3) << 1;
-	cnt = (511 - cpu.tim + (1<<unit)) >> unit;
-	cnt += (255 - R_TIMA) << (9 - unit);
+	/* The next timer interrupt is already scheduled; see B */
+	cnt = (cpu.tdue - cpu.tpend + (1<<cpu.speed) - 1) >> cpu.speed;
 
 	if (max < cnt)
 		cnt = max;
@@ -954,8 +995,8 @@ next:
 	/* Advance time counters */
 	/* FIXME: make use of cpu_timers() */
 	clen <<= 1;
-	div_advance(clen);
-	timer_advance(clen);
+	cpu.tpend += clen;
+	if (cpu.tpend >= cpu.tdue) timer_sync();
 	clen >>= cpu.speed;
 	lcdc_advance(clen);
 	sound_advance(clen);
@@ -18,6 +18,9 @@
 #include <stdint.h>
 
 #include "i80_lcd.h"
+#include "frame_exchange.h"
+#include "frame_policy.h"
+#include "video_band.h"
 
 struct lcd lcd;
 
@@ -643,17 +646,13 @@ inline void lcd_begin()
 }
 
 
-extern int frame;
-extern uint16_t* displayBuffer[2];
+extern uint16_t* displayBuffer[3];
 int lastLcdDisabled = 0;
 
 void IRAM_ATTR lcd_refreshline()
 {
 	byte *dest;
 
-	if ((frame % 7) == 0) ++frame;
-
-
 	L = R_LY;
 	X = R_SCX;
 	Y = (R_SCY + L) & 0xff;
@@ -668,7 +667,7 @@ void IRAM_ATTR lcd_refreshline()
 	WT = (L - WY) >> 3;
 	WV = (L - WY) & 7;
 
-	if ((frame % 2) == 0)
+	if (frame_policy_should_render())
 	{
 		if (!(R_LCDC & 0x80))
 		{
@@ -676,6 +675,7 @@ void IRAM_ATTR lcd_refreshline()
 			{
 				memset(displayBuffer[0], 0xff, 144 * 160 * 2);
 				memset(displayBuffer[1], 0xff, 144 * 160 * 2);
+				memset(displayBuffer[2], 0xff, 144 * 160 * 2);
 
 				lastLcdDisabled = 1;
 			}
@@ -714,32 +714,41 @@ void IRAM_ATTR lcd_refreshline()
 		byte* src = BUF;
 
 		while (cnt--) *(dst++) = PAL2[*(src++)];
+
+		/* let the video task follow along a band at a time */
+		if (L == 143 || ((L + 1) % VIDEO_BAND_LINES) == 0)
+			frame_exchange_lines_done(L + 1);
 	}
 
 	vdest += fb.pitch;
 }
 
-inline static void updatepalette(int i)
-{
-	short c;
-	short r, g, b; //, y, u, v, rr, gg;
-
-	short low = lcd.pal[i << 1];
-	short high = lcd.pal[(i << 1) | 1];
-
-	c = (low | (high << 8)) & 0x7fff;
+/* PAL2 holds colors ready to go to the panel, in the byte order
+	make_color() produces for the transfers. make_color() packs each
+	channel into bits of its own, so it is worked out once per level of
+	each channel here and palette writes just OR three entries together */
+static un16 pal_red[32], pal_green[32], pal_blue[32];
 
-	//bit 0-4 red
-	r = c & 0x1f;
+static void pal_buildcache()
+{
+	int i;
 
-	// bit 5-9 green
-	g = (c >> 5) & 0x1f;
+	for (i = 0; i < 32; i++)
+	{
+		pal_red[i] = make_color(i << 3, 0, 0);
+		pal_green[i] = make_color(0, i << 3, 0);
+		pal_blue[i] = make_color(0, 0, i << 3);
+	}
+}
 
-	// bit 10-14 blue
-	b = (c >> 10) & 0x1f;
+inline static void updatepalette(int i)
+{
+	int c = (lcd.pal[i << 1] | (lcd.pal[(i << 1) | 1] << 8)) & 0x7fff;
 
-	// PAL2[i] = (r << 11) | (g << (5 + 1)) | (b);
-	PAL2[i] = make_color(r << 3 , g << 3 , b << 3);
+	/* bits 0-4 red, 5-9 green, 10-14 blue */
+	PAL2[i] = pal_red[c & 0x1f]
+		| pal_green[(c >> 5) & 0x1f]
+		| pal_blue[(c >> 10) & 0x1f];
 }
 
 inline void pal_write(int i, byte b)
@@ -751,6 +760,17 @@ inline void pal_write(int i, byte b)
 	}
 }
 
+/* both bytes of a color at once, so the entry is only updated once */
+inline static void pal_write_color(int i, int c)
+{
+	if (lcd.pal[i] != (c & 0xff) || lcd.pal[i+1] != (c >> 8))
+	{
+		lcd.pal[i] = c & 0xff;
+		lcd.pal[i+1] = c >> 8;
+		updatepalette(i>>1);
+	}
+}
+
 void IRAM_ATTR pal_write_dmg(int i, int mapnum, byte d)
 {
 	int j;
@@ -769,8 +789,7 @@ void IRAM_ATTR pal_write_dmg(int i, int mapnum, byte d)
 		c = r | g | b;
 
 		/* FIXME - handle directly without faking cgb */
-		pal_write(i+j, c & 0xff);
-		pal_write(i+j+1, c >> 8);
+		pal_write_color(i+j, c);
 	}
 
 	//printf("pal_write_dmg: i=%d, d=0x%x\n", i , d);
@@ -812,6 +831,7 @@ void lcd_reset()
 {
 	memset(&lcd, 0, sizeof lcd);
 
+	pal_buildcache();
 	lcd_begin();
 	vram_dirty();
 	pal_dirty();
@@ -8,6 +8,7 @@
 #include "gnuboy/cpu.h"
 #include "gnuboy/regs.h"
 #include "gnuboy/lcd.h"
+#include "gnuboy/sound.h"
 
 #include <esp_attr.h>
 
@@ -149,6 +150,12 @@ void IRAM_ATTR lcdc_trans()
 			handle transfer
 	}
 	*/
+
+	/* Mix the sound a few samples at a time as the frame goes by
+	instead of all of it at vblank. sound_write() already mixes up to
+	the time of the write, so this only spreads the work out. */
+	sound_mix();
+
 	if (!(R_LCDC & 0x80))
 	{
 		/* LCDC operation disabled (short route) */
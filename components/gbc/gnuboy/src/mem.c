@@ -7,6 +7,7 @@
 #include "gnuboy/hw.h"
 #include "gnuboy/regs.h"
 #include "gnuboy/mem.h"
+#include "gnuboy/cpu.h"
 #include "gnuboy/rtc.h"
 #include "gnuboy/lcd.h"
 #include "gnuboy/sound.h"
@@ -147,6 +148,10 @@ void IRAM_ATTR ioreg_write(byte r, byte b)
 		case RI_TIMA:
 		case RI_TMA:
 		case RI_TAC:
+		timer_sync();
+		REG(r) = b;
+		timer_schedule();
+		break;
 		case RI_SCY:
 		case RI_SCX:
 		case RI_WY:
@@ -191,6 +196,7 @@ void IRAM_ATTR ioreg_write(byte r, byte b)
 		REG(r) = b;
 		break;
 		case RI_DIV:
+		timer_sync();
 		REG(r) = 0;
 		break;
 		case RI_LCDC:
@@ -277,10 +283,12 @@ byte IRAM_ATTR ioreg_read(byte r)
 		r = R_SC;
 		R_SC &= 0x7f;
 		return r;
-		case RI_P1:
-		case RI_SB:
 		case RI_DIV:
 		case RI_TIMA:
+		timer_sync();
+		return REG(r);
+		case RI_P1:
+		case RI_SB:
 		case RI_TMA:
 		case RI_TAC:
 		case RI_LCDC:
@@ -223,15 +223,13 @@ void loadstate(FILE *f)
 	__asm__("nop");
 	__asm__("nop");
 	__asm__("memw");
-	size_t count = fread(ram.sbank, 4096, srl, f);
+	fread(ram.sbank, 4096, srl, f);
 	__asm__("nop");
 	__asm__("nop");
 	__asm__("nop");
 	__asm__("nop");
 	__asm__("memw");
 
-	printf("loadstate: read sram addr=%p, size=0x%x, count=%d\n", (void*)ram.sbank, 4096 * srl, count);
-
 	//byte* ptr = (byte*)(0x3f800000 + 0x300000 + (0xbe7a & 0x1fff));
 	//printf("loadstate: watch = 0x%x, 0x%x, 0x%x, 0x%x\n", *ptr, *(ptr+1), *(ptr+2), *(ptr+3));
 
@@ -252,6 +250,8 @@ void savestate(FILE *f)
 	int vrl = hw.cgb ? 4 : 2;
 	int srl = mbc.ramsize << 1;
 
+	timer_sync();
+
 	ver = 0x105;
 	iramblock = 1;
 	vramblock = 1+irl;
@@ -310,14 +310,13 @@ void savestate(FILE *f)
 		__asm__("nop");
 		__asm__("nop");
 		__asm__("memw");
-		size_t count = fwrite(buf, 4096, 1, f);
+		fwrite(buf, 4096, 1, f);
 		__asm__("nop");
 		__asm__("nop");
 		__asm__("nop");
 		__asm__("nop");
 		__asm__("memw");
 
-		printf("savesate: wrote sram addr=%p, size=0x%x, count=%d\n", (void*)tmp, 4096, count);
 		tmp += 4096;
 	}
 
@@ -10,6 +10,12 @@
 #include "i80_lcd.h"
 #include "i2s_audio.h"
 #include "badge_input.h"
+#include "display_pipeline.h"
+#include "frame_exchange.h"
+#include "frame_policy.h"
+#include "overlay.h"
+#include "rewind.h"
+#include "scaler.h"
 #include "st7789.hpp"
 #include "task.hpp"
 
@@ -36,11 +42,10 @@ extern "C" {
 using namespace std::chrono_literals;
 
 // need to have these haere for gnuboy to work
-uint16_t* displayBuffer[2];
+uint16_t* displayBuffer[3];
 uint16_t* framebuffer;
 struct fb fb;
 struct pcm pcm;
-uint8_t currentBuffer = 0;
 int frame = 0;
 
 int32_t* audioBuffer[2];
@@ -53,74 +58,26 @@ extern "C" void die(char *fmt, ...) {
 }
 
 static std::shared_ptr<espp::Task> gbc_task;
-static std::shared_ptr<espp::Task> gbc_video_task;
-static QueueHandle_t video_queue;
 static float totalElapsedSeconds = 0;
 static struct InputState state;
 
 static std::atomic<bool> special_func_ready = false;
-static std::atomic<bool> scaled = false;
-static std::atomic<bool> filled = false;
-bool video_task(std::mutex &m, std::condition_variable& cv) {
-  static uint16_t *_frame;
-  if (xQueuePeek(video_queue, &_frame, 100 / portTICK_PERIOD_MS) != pdTRUE) {
-    fmt::print("gameboy: no frame to write\n");
-    // we couldn't get anything from the queue, return
-    return false;
-  }
-
-  static int vram_index = 0;
-  if (scaled || filled) {
-    int x_offset = filled ? 0 : (320-266)/2;
-    int y_offset = 0;
-    // since the screen is 320x240 and the gameboy screen is 160x144
-    // we need to scale the gameboy by 240/144 to fit the screen
-    // and by 320/160 to fill the screen
-    float y_scale = 1.667f;
-    float x_scale = scaled ? y_scale : 2.0f;
-    int max_y = 240;
-    int max_x = std::clamp((int)(x_scale * 160.0f), 0, 320);
-
-    static constexpr int num_lines_to_write = NUM_ROWS_IN_FRAME_BUFFER;
-    for (int y=0; y<max_y; y+=num_lines_to_write) {
-      uint16_t* _buf = vram_index ? (uint16_t*)get_vram1() : (uint16_t*)get_vram0();
-      vram_index = vram_index ? 0 : 1;
-      int i = 0;
-      for (; i<num_lines_to_write; i++) {
-        int _y = y+i;
-        if (_y >= max_y) {
-          break;
-        }
-        int source_y = (float)_y/y_scale;
-        for (int x=0; x<max_x; x++) {
-          int source_x = (float)x/x_scale;
-          _buf[i*max_x + x] = _frame[source_y*160 + source_x];
-        }
-      }
-      lcd_write_frame(0 + x_offset, y, max_x, i, (uint8_t*)&_buf[0]);
-    }
-  } else {
-    constexpr int x_offset = (320-160)/2;
-    constexpr int y_offset = (240-144)/2;
-    static constexpr int num_lines_to_write = NUM_ROWS_IN_FRAME_BUFFER;
-    for (int y=0; y<144; y+= num_lines_to_write) {
-      uint16_t* _buf = vram_index ? (uint16_t*)get_vram1() : (uint16_t*)get_vram0();
-      vram_index = vram_index ? 0 : 1;
-      int num_lines = std::min(num_lines_to_write, 144-y);
-      memcpy(_buf, &_frame[y*160], num_lines*160*2);
-      lcd_write_frame(x_offset, y + y_offset, 160, num_lines, (uint8_t*)&_buf[0]);
-    }
-  }
-  // we don't have to worry here since we know there was an item in the queue
-  // since we peeked earlier.
-  xQueueReceive(video_queue, &_frame, 10 / portTICK_PERIOD_MS);
-  return false;
-}
+// tables for the FIT and FILL modes, built when the mode is picked
+static Scaler fit_scaler;
+static Scaler fill_scaler;
 
 bool run_to_vblank(std::mutex &m, std::condition_variable& cv) {
   /* FRAME BEGIN */
   auto start = std::chrono::high_resolution_clock::now();
 
+  auto delay = std::chrono::microseconds(frame_policy_frame_period_us());
+  // while rewind is held only the frames it restores are run
+  if (!rewind_update()) {
+    std::this_thread::sleep_until(start + delay);
+    return false;
+  }
+  frame_policy_begin_frame();
+
   /* FIXME: judging by the time specified this was intended
   to emulate through vblank phase which is handled at the
   end of the loop. */
@@ -135,12 +92,11 @@ bool run_to_vblank(std::mutex &m, std::condition_variable& cv) {
   }
 
   /* VBLANK BEGIN */
-  if ((frame % 2) == 0) {
-    xQueueSend(video_queue, (void*)&framebuffer, 100 / portTICK_PERIOD_MS);
-
-    // swap buffers
-    currentBuffer = currentBuffer ? 0 : 1;
-    framebuffer = displayBuffer[currentBuffer];
+  if (frame_policy_should_render()) {
+    // hand the frame over and move on to whichever buffer the display isn't
+    // using, this never waits on the display
+    frame_exchange_publish();
+    framebuffer = (uint16_t*)frame_exchange_back();
     fb.ptr = (uint8_t*)framebuffer;
   }
 
@@ -149,10 +105,14 @@ bool run_to_vblank(std::mutex &m, std::condition_variable& cv) {
   sound_mix();
 
   if (pcm.pos > 100) {
-    currentAudioBufferPtr = audioBuffer[currentAudioBuffer];
-    currentAudioSampleCount = pcm.pos;
+    // in turbo the sound is still mixed (games poll the channel status) but
+    // not played, since the blocking I2S write would hold us to real time
+    if (frame_policy_should_play_audio() && !rewind_is_active()) {
+      currentAudioBufferPtr = audioBuffer[currentAudioBuffer];
+      currentAudioSampleCount = pcm.pos;
 
-    audio_play_frame((uint8_t*)currentAudioBufferPtr, currentAudioSampleCount * 2);
+      audio_play_frame((uint8_t*)currentAudioBufferPtr, currentAudioSampleCount * 2);
+    }
 
     // Swap buffers
     // currentAudioBuffer = currentAudioBuffer ? 0 : 1;
@@ -175,36 +135,85 @@ bool run_to_vblank(std::mutex &m, std::condition_variable& cv) {
     emu_step();
   }
   ++frame;
+  frame_policy_end_frame();
   auto end = std::chrono::high_resolution_clock::now();
   auto elapsed = std::chrono::duration<float>(end-start).count();
   totalElapsedSeconds += elapsed;
   if ((frame % 60) == 0) {
     fmt::print("gameboy: FPS {}\n", (float) frame / totalElapsedSeconds);
+    frame_policy_print_stats();
+    frame_exchange_print_stats();
+    display_pipeline_print_stats();
+    lcd_print_stats();
+    rewind_print_stats();
   }
-  // frame rate should be 60 FPS, so 1/60th second is what we want to sleep for
-  // note: 1/60 negatively affects sound, try 1/128
-  static constexpr auto delay = std::chrono::duration<float>(1.0f/128.0f);
   std::this_thread::sleep_until(start + delay);
   return false;
 }
 
 void set_gb_video_original() {
-  scaled = false;
-  filled = false;
+  display_pipeline_set_scaler(nullptr);
 }
 
 void set_gb_video_fit() {
-  scaled = true;
-  filled = false;
+  // the screen is 320x240 and the gameboy screen is 160x144, so scale by
+  // 240/144 both ways to fit the screen
+  scaler_init(&fit_scaler, GAMEBOY_SCREEN_WIDTH, GAMEBOY_SCREEN_HEIGHT, 266, 240, SCALER_DEFAULT_FILTER);
+  display_pipeline_set_scaler(&fit_scaler);
 }
 
 void set_gb_video_fill() {
-  scaled = false;
-  filled = true;
+  // and by 320/160 horizontally to fill it
+  scaler_init(&fill_scaler, GAMEBOY_SCREEN_WIDTH, GAMEBOY_SCREEN_HEIGHT, 320, 240, SCALER_DEFAULT_FILTER);
+  display_pipeline_set_scaler(&fill_scaler);
 }
 
 void reset_gameboy() {
   emu_reset();
+  rewind_reset();
+}
+
+static size_t gameboy_state_size() {
+  // matches the block layout used by savestate()
+  int irl = hw.cgb ? 8 : 2;
+  int vrl = hw.cgb ? 4 : 2;
+  int srl = mbc.ramsize << 1;
+  return (1 + irl + vrl + srl) << 12;
+}
+
+static void refresh_after_loadstate() {
+  vram_dirty();
+  pal_dirty();
+  sound_dirty();
+  timer_dirty();
+  mem_updatemap();
+}
+
+static size_t save_gameboy_state(uint8_t *buffer, size_t capacity) {
+  size_t size = gameboy_state_size();
+  if (size > capacity) {
+    return 0;
+  }
+  auto f = fmemopen(buffer, capacity, "wb");
+  if (!f) {
+    return 0;
+  }
+  setvbuf(f, nullptr, _IONBF, 0);
+  savestate(f);
+  fclose(f);
+  return size;
+}
+
+static bool load_gameboy_state(const uint8_t *buffer, size_t size) {
+  auto f = fmemopen((void*)buffer, size, "rb");
+  if (!f) {
+    return false;
+  }
+  setvbuf(f, nullptr, _IONBF, 0);
+  loadstate(f);
+  fclose(f);
+  refresh_after_loadstate();
+  return true;
 }
 
 void init_gameboy(const std::string& rom_filename, uint8_t *romdata, size_t rom_data_size) {
@@ -213,8 +222,20 @@ void init_gameboy(const std::string& rom_filename, uint8_t *romdata, size_t rom_
   // lcd_set_queued_transmit();
   // Note: Magic number obtained by adjusting until audio buffer overflows stop.
   const int audioBufferLength = AUDIO_BUFFER_SIZE;
+  // frame_buffer0 is big enough for two gameboy frames
   displayBuffer[0] = (uint16_t*)get_frame_buffer0();
-  displayBuffer[1] = (uint16_t*)get_frame_buffer1();
+  displayBuffer[1] = displayBuffer[0] + GAMEBOY_SCREEN_WIDTH * GAMEBOY_SCREEN_HEIGHT;
+  displayBuffer[2] = (uint16_t*)get_frame_buffer1();
+  frame_exchange_init((uint8_t*)displayBuffer[0], (uint8_t*)displayBuffer[1],
+                      (uint8_t*)displayBuffer[2], GAMEBOY_SCREEN_HEIGHT);
+  DisplaySource source = {
+    .format = DISPLAY_SOURCE_RGB565,
+    .width = GAMEBOY_SCREEN_WIDTH,
+    .height = GAMEBOY_SCREEN_HEIGHT,
+    .pitch = GAMEBOY_SCREEN_WIDTH * sizeof(uint16_t),
+  };
+  display_pipeline_init(&source);
+  display_pipeline_set_overlay(overlay_draw);
   audioBuffer[0] = (int32_t*)get_audio_buffer();
   audioBuffer[1] = (int32_t*)get_audio_buffer();
 
@@ -224,10 +245,10 @@ void init_gameboy(const std::string& rom_filename, uint8_t *romdata, size_t rom_
   fb.pelsize = 2;
   fb.pitch = fb.w * fb.pelsize;
   fb.indexed = 0;
-  fb.ptr = (uint8_t*)displayBuffer[0];
+  framebuffer = (uint16_t*)frame_exchange_back();
+  fb.ptr = (uint8_t*)framebuffer;
   fb.enabled = 1;
   fb.dirty = 0;
-  framebuffer = displayBuffer[0];
 
   // pcm.len = count of 16bit samples (x2 for stereo)
   memset(&pcm, 0, sizeof(pcm));
@@ -243,6 +264,8 @@ void init_gameboy(const std::string& rom_filename, uint8_t *romdata, size_t rom_
   emu_reset();
   totalElapsedSeconds = 0;
   frame = 0;
+  frame_policy_reset();
+  rewind_init(gameboy_state_size(), save_gameboy_state, load_gameboy_state);
   if (!initialized) {
     gbc_task = std::make_shared<espp::Task>(espp::Task::Config{
         .name = "gbc task",
@@ -251,14 +274,6 @@ void init_gameboy(const std::string& rom_filename, uint8_t *romdata, size_t rom_
         .priority = 15,
         .core_id = 0
       });
-    gbc_video_task = std::make_shared<espp::Task>(espp::Task::Config{
-        .name = "gbc video task",
-        .callback = video_task,
-        .stack_size_bytes = 10*1024,
-        .priority = 20,
-        .core_id = 1
-      });
-    video_queue = xQueueCreate(1, sizeof(uint16_t*));
   }
   initialized = true;
 }
@@ -267,21 +282,32 @@ void run_gameboy_rom() {
   // GET INPUT
   get_input_state(&state);
   // check buttons for select button/audio changes (no touchscreen) - don't pass to game
+  // A+B+LEFT rewinds for as long as it is held, so it is not one-shot like the rest
+  rewind_set_active(state.a && state.b && state.left);
   if(state.a && state.b) {
-    if(special_func_ready && state.up) {
+    if(state.left) {
+      special_func_ready = false;
+      return;
+    } else if(special_func_ready && state.up) {
       special_func_ready = false;
       set_audio_volume(get_audio_volume() + 10);
+      overlay_show_volume(get_audio_volume());
       return;
     } else if(special_func_ready && state.down) {
       special_func_ready = false;
       set_audio_volume(get_audio_volume() - 10);
+      overlay_show_volume(get_audio_volume());
+      return;
+    } else if(special_func_ready && state.right) {
+      special_func_ready = false;
+      frame_policy_cycle_speed();
       return;
     } else if(special_func_ready && state.start) {
       special_func_ready = false;
       state.select = 1;
       state.a = 0;
       state.b = 0;
-    } else if(!(state.up || state.down || state.start)) {
+    } else if(!(state.up || state.down || state.right || state.start)) {
       special_func_ready = true;
     } else {
       return;
@@ -303,10 +329,8 @@ void load_gameboy(std::string_view save_path) {
     auto f = fopen(save_path.data(), "rb");
     loadstate(f);
     fclose(f);
-		vram_dirty();
-		pal_dirty();
-		sound_dirty();
-		mem_updatemap();
+    refresh_after_loadstate();
+    rewind_reset();
   }
 }
 
@@ -320,17 +344,17 @@ void save_gameboy(std::string_view save_path) {
 void stop_gameboy_tasks() {
   // stop the task...
   gbc_task->stop();
-  gbc_video_task->stop();
+  display_pipeline_stop();
 }
 
 void start_gameboy_tasks() {
   // stop the task...
   gbc_task->start();
-  gbc_video_task->start();
+  display_pipeline_start();
 }
 
 std::vector<uint8_t> get_gameboy_video_buffer() {
-  uint8_t* frame_buffer = get_frame_buffer0();
+  const uint8_t* frame_buffer = frame_exchange_latest();
   // copy the frame buffer to a new buffer
   auto width = GAMEBOY_SCREEN_WIDTH;
   auto height = GAMEBOY_SCREEN_HEIGHT;
@@ -343,5 +367,6 @@ std::vector<uint8_t> get_gameboy_video_buffer() {
 
 void deinit_gameboy() {
   // now unload everything
+  rewind_deinit();
   loader_unload();
 }
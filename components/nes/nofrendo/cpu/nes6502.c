@@ -26,10 +26,19 @@
 */
 
 
+#include <string.h>
 #include <noftypes.h>
 #include "nes6502.h"
 #include "dis6502.h"
 
+#ifdef NES6502_MEMBENCH
+#include <stdio.h>
+#include <sys/time.h>
+#ifndef NES6502_MEMBENCH_LOOPS
+#define  NES6502_MEMBENCH_LOOPS  50000
+#endif /* !NES6502_MEMBENCH_LOOPS */
+#endif /* NES6502_MEMBENCH */
+
 //#define  NES6502_DISASM
 
 #ifdef __GNUC__
@@ -1139,6 +1148,15 @@ static int remaining_cycles = 0; /* so we can release timeslice */
 static uint8 *ram = NULL, *stack = NULL;
 static uint8 null_page[NES6502_BANKSIZE];
 
+/* memory handlers sorted by 256 byte page, see nes6502_compilehandlers() */
+#define  HANDLER_PAGES        0x100
+#define  HANDLER_PAGESHIFT    8
+#define  HANDLER_POOLSIZE     256
+static nes6502_memread *read_page[HANDLER_PAGES];
+static nes6502_memwrite *write_page[HANDLER_PAGES];
+static nes6502_memread read_pool[HANDLER_POOLSIZE];
+static nes6502_memwrite write_pool[HANDLER_POOLSIZE];
+
 
 /*
 ** Zero-page helper macros
@@ -1220,7 +1238,7 @@ static uint8 mem_readbyte(uint32 address)
    /* check memory range handlers */
    else
    {
-      for (mr = nes_cpu.read_handler; mr->min_range != 0xFFFFFFFF; mr++)
+      for (mr = read_page[address >> HANDLER_PAGESHIFT]; mr->min_range != 0xFFFFFFFF; mr++)
       {
          if (address >= mr->min_range && address <= mr->max_range)
             return mr->read_func(address);
@@ -1245,7 +1263,7 @@ static void mem_writebyte(uint32 address, uint8 value)
    /* check memory range handlers */
    else
    {
-      for (mw = nes_cpu.write_handler; mw->min_range != 0xFFFFFFFF; mw++)
+      for (mw = write_page[address >> HANDLER_PAGESHIFT]; mw->min_range != 0xFFFFFFFF; mw++)
       {
          if (address >= mw->min_range && address <= mw->max_range)
          {
@@ -1259,6 +1277,148 @@ static void mem_writebyte(uint32 address, uint8 value)
    bank_writebyte(address, value);
 }
 
+/* Compile a handler list into per-page lists: for each 256 byte page, the
+** handlers that overlap it, in their original order, up to the first one
+** that covers the whole page (nothing after it can match).  Consecutive pages
+** with the same list share one copy.  Returns false if the pool is too small.
+*/
+#define  COMPILE_PAGES(type, handlers, pool, pages, func) \
+{ \
+   type *h; \
+   int page, used = 0, prev_start = -1; \
+   for (page = 0; page < HANDLER_PAGES; page++) \
+   { \
+      uint32 lo = page << HANDLER_PAGESHIFT; \
+      uint32 hi = lo + (1 << HANDLER_PAGESHIFT) - 1; \
+      int start = used; \
+      for (h = (handlers); h->min_range != 0xFFFFFFFF; h++) \
+      { \
+         if (h->max_range < lo || h->min_range > hi) \
+            continue; \
+         if (used >= HANDLER_POOLSIZE - 1) \
+            return false; \
+         (pool)[used++] = *h; \
+         if (h->min_range <= lo && h->max_range >= hi) \
+            break; \
+      } \
+      (pool)[used].min_range = (pool)[used].max_range = 0xFFFFFFFF; \
+      (pool)[used].func = NULL; \
+      used++; \
+      if (prev_start >= 0 && used - start == start - prev_start \
+          && 0 == memcmp(&(pool)[prev_start], &(pool)[start], (used - start) * sizeof(type))) \
+      { \
+         (pages)[page] = (pages)[page - 1]; \
+         used = start; \
+      } \
+      else \
+      { \
+         (pages)[page] = &(pool)[start]; \
+         prev_start = start; \
+      } \
+   } \
+   return true; \
+}
+
+static bool compile_read_pages(void)
+{
+   COMPILE_PAGES(nes6502_memread, nes_cpu.read_handler, read_pool, read_page, read_func);
+}
+
+static bool compile_write_pages(void)
+{
+   COMPILE_PAGES(nes6502_memwrite, nes_cpu.write_handler, write_pool, write_page, write_func);
+}
+
+/* sort the current context's memory handlers by page, so a bus access only
+** looks at the handlers that can match it.  Call this whenever the handler
+** lists change.
+*/
+void nes6502_compilehandlers(void)
+{
+   int page;
+
+   if (false == compile_read_pages())
+   {
+      /* fall back to scanning the full list */
+      for (page = 0; page < HANDLER_PAGES; page++)
+         read_page[page] = nes_cpu.read_handler;
+   }
+
+   if (false == compile_write_pages())
+   {
+      for (page = 0; page < HANDLER_PAGES; page++)
+         write_page[page] = nes_cpu.write_handler;
+   }
+}
+
+#ifdef NES6502_MEMBENCH
+/* the lookup used before nes6502_compilehandlers(), for comparison */
+static uint8 mem_readbyte_linear(uint32 address)
+{
+   nes6502_memread *mr;
+
+   for (mr = nes_cpu.read_handler; mr->min_range != 0xFFFFFFFF; mr++)
+   {
+      if (address >= mr->min_range && address <= mr->max_range)
+         return mr->read_func(address);
+   }
+
+   return bank_readbyte(address);
+}
+
+static uint32 membench_usec(void)
+{
+   struct timeval tv;
+
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* time reads of the registers games poll most, through the full handler
+** list and through the per-page lists.  Reads have side effects on the PPU
+** and input, so only run this before a reset.
+*/
+void nes6502_membench(void)
+{
+   static const uint32 addresses[] = { 0x2002, 0x4016, 0x2007, 0x4015 };
+   const int loops = NES6502_MEMBENCH_LOOPS;
+   volatile uint8 sink = 0;
+   uint32 start, linear_usec, paged_usec;
+   int i, j;
+
+   start = membench_usec();
+   for (i = 0; i < loops; i++)
+      for (j = 0; j < 4; j++)
+         sink += mem_readbyte_linear(addresses[j]);
+   linear_usec = membench_usec() - start;
+
+   start = membench_usec();
+   for (i = 0; i < loops; i++)
+      for (j = 0; j < 4; j++)
+         sink += mem_readbyte(addresses[j]);
+   paged_usec = membench_usec() - start;
+
+   printf("nes6502: memory bus %u reads/s with the full handler list, %u reads/s with page lists\n",
+          (uint32) (4000000.0 * loops / (linear_usec ? linear_usec : 1)),
+          (uint32) (4000000.0 * loops / (paged_usec ? paged_usec : 1)));
+   (void) sink;
+}
+#endif /* NES6502_MEMBENCH */
+
+/* Bank switches happen many times a frame, so they go straight to the
+** live page table instead of a getcontext / setcontext round trip.  The
+** execution loop reads mem_page[] through nes_cpu, so it sees the new
+** banks from the next fetch on.
+*/
+void nes6502_setbanks(int bank, int count, uint8 *location)
+{
+   while (count--)
+   {
+      nes_cpu.mem_page[bank++] = location;
+      location += NES6502_BANKSIZE;
+   }
+}
+
 /* set the current context */
 void nes6502_setcontext(nes6502_context *context)
 {
@@ -1302,6 +1462,12 @@ uint8 nes6502_getbyte(uint32 address)
    return bank_readbyte(address);
 }
 
+/* the 256 bytes of memory behind a page, as nes6502_getbyte() sees them */
+uint8 *nes6502_getpage(uint32 address)
+{
+   return nes_cpu.mem_page[address >> NES6502_BANKSHIFT] + (address & NES6502_BANKMASK & ~0xFF);
+}
+
 /* get number of elapsed cycles */
 uint32 nes6502_getcycles(bool reset_flag)
 {
@@ -2462,6 +2628,23 @@ void nes6502_burn(int cycles)
    nes_cpu.burn_cycles += cycles;
 }
 
+/* Take cycles out of the running timeslice (DMA) without ending it, so the
+** CPU carries on up to the next event; what doesn't fit in the slice is
+** burned at the start of the next one
+*/
+void nes6502_stall(int cycles)
+{
+   int stall_for = MIN(cycles, remaining_cycles);
+
+   if (stall_for > 0)
+   {
+      ADD_CYCLES(stall_for);
+      cycles -= stall_for;
+   }
+
+   nes_cpu.burn_cycles += cycles;
+}
+
 /* Release our timeslice */
 void nes6502_release(void)
 {
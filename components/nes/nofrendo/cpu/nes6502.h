@@ -34,6 +34,9 @@
 /* Define this to enable decimal mode in ADC / SBC (not needed in NES) */
 /*#define  NES6502_DECIMAL*/
 
+/* Define this to time memory handler lookups when a cart is inserted */
+/*#define  NES6502_MEMBENCH*/
+
 #define  NES6502_NUMBANKS  16
 #define  NES6502_BANKSHIFT 12
 #define  NES6502_BANKSIZE  (0x10000 / NES6502_NUMBANKS)
@@ -105,14 +108,25 @@ extern int nes6502_execute(int total_cycles);
 extern void nes6502_nmi(void);
 extern void nes6502_irq(void);
 extern uint8 nes6502_getbyte(uint32 address);
+extern uint8 *nes6502_getpage(uint32 address);
 extern uint32 nes6502_getcycles(bool reset_flag);
 extern void nes6502_burn(int cycles);
+extern void nes6502_stall(int cycles);
 extern void nes6502_release(void);
 
 /* Context get/set */
 extern void nes6502_setcontext(nes6502_context *cpu);
 extern void nes6502_getcontext(nes6502_context *cpu);
 
+/* rebuild the per-page handler lookup after read/write_handler change */
+extern void nes6502_compilehandlers(void);
+
+/* point count banks starting at bank somewhere else, in the live context */
+extern void nes6502_setbanks(int bank, int count, uint8 *location);
+#ifdef NES6502_MEMBENCH
+extern void nes6502_membench(void);
+#endif /* NES6502_MEMBENCH */
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -204,42 +204,53 @@ SNSS_WriteFileHeader (SNSS_FILE *snssFile)
 SNSS_RETURN_CODE
 SNSS_OpenFile (SNSS_FILE **snssFile, const char *filename, SNSS_OPEN_MODE mode)
 {
-   *snssFile = malloc(sizeof(SNSS_FILE));
-   if (NULL == *snssFile)
-   {
-       abort();
-      return SNSS_OUT_OF_MEMORY;
-   }
-
-   /* zero the memory */
-   memset (*snssFile, 0, sizeof(SNSS_FILE));
-
-   (*snssFile)->mode = mode;
+   FILE *fp;
 
    if (SNSS_OPEN_READ == mode)
    {
-      (*snssFile)->fp = fopen (filename, "rb");
+      fp = fopen (filename, "rb");
    }
    else
    {
-      (*snssFile)->fp = fopen (filename, "wb");
-      (*snssFile)->headerBlock.numberOfBlocks = 0;
+      fp = fopen (filename, "wb");
    }
 
-   if (NULL == (*snssFile)->fp)
+   if (NULL == fp)
    {
        //abort();
-      free(*snssFile);
       *snssFile = NULL;
       return SNSS_OPEN_FAILED;
    }
 
+   return SNSS_OpenStream (snssFile, fp, mode);
+}
+
+/**************************************************************************/
+
+/* takes ownership of fp, which is closed by SNSS_CloseFile */
+SNSS_RETURN_CODE
+SNSS_OpenStream (SNSS_FILE **snssFile, FILE *fp, SNSS_OPEN_MODE mode)
+{
+   *snssFile = malloc(sizeof(SNSS_FILE));
+   if (NULL == *snssFile)
+   {
+       abort();
+      return SNSS_OUT_OF_MEMORY;
+   }
+
+   /* zero the memory */
+   memset (*snssFile, 0, sizeof(SNSS_FILE));
+
+   (*snssFile)->mode = mode;
+   (*snssFile)->fp = fp;
+
    if (SNSS_OPEN_READ == mode)
    {
       return SNSS_ReadFileHeader(*snssFile);
    }
    else
    {
+      (*snssFile)->headerBlock.numberOfBlocks = 0;
       return SNSS_WriteFileHeader(*snssFile);
    }
 }
@@ -41,6 +41,10 @@ static uint16 vrombase;
 /* mapper 4: MMC3 */
 static void map4_write(uint32 address, uint8 value)
 {
+   /* any write reloads the counter after it fired */
+   if (address >= 0xC000 || irq.reset)
+      nes_irqsync();
+
    switch (address & 0xE001)
    {
    case 0x8000:
@@ -174,6 +178,14 @@ static void map4_hblank(int vblank)
    }
 }
 
+static int map4_irqlines(void)
+{
+   if (false == irq.enabled || false == ppu_enabled() || irq.counter < 0)
+      return 0;
+
+   return irq.counter + 1;
+}
+
 static void map4_getstate(SnssMapperBlock *state)
 {
    state->extraData.mapper4.irqCounter = irq.counter;
@@ -215,7 +227,8 @@ mapintf_t map4_intf =
    map4_setstate, /* set state (snss) */
    NULL, /* memory read structure */
    map4_memwrite, /* memory write structure */
-   NULL /* external sound device */
+   NULL, /* external sound device */
+   map4_irqlines /* hblanks to next IRQ */
 };
 
 /*
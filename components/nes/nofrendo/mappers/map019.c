@@ -26,8 +26,7 @@
 #include <noftypes.h>
 #include <nes_mmc.h>
 #include <nes_ppu.h>
-
-/* TODO: shouldn't there be an h-blank IRQ handler??? */
+#include <nes.h>
 
 /* Special mirroring macro for mapper 19 */
 #define N_BANK1(table, value) \
@@ -42,11 +41,43 @@
 static struct
 {
    int counter, enabled;
+   int thirds;
 } irq;
 
 static void map19_init(void)
 {
    irq.counter = irq.enabled = 0;
+   irq.thirds = 0;
+}
+
+/* the counter goes up every CPU cycle and fires when it reaches $7FFF,
+** counted here a scanline (341 / 3 cycles) at a time
+*/
+static void map19_hblank(int vblank)
+{
+   UNUSED(vblank);
+
+   if (irq.enabled && irq.counter < 0x7FFF)
+   {
+      irq.thirds += 341;
+      irq.counter += irq.thirds / 3;
+      irq.thirds %= 3;
+
+      if (irq.counter >= 0x7FFF)
+      {
+         irq.counter = 0x7FFF;
+         nes_irq();
+      }
+   }
+}
+
+static int map19_irqlines(void)
+{
+   if (false == irq.enabled || irq.counter >= 0x7FFF)
+      return 0;
+
+   /* no more than 114 cycles a line */
+   return (0x7FFF - irq.counter + 113) / 114;
 }
 
 /* mapper 19: Namcot 106 */
@@ -56,11 +87,13 @@ static void map19_write(uint32 address, uint8 value)
    switch (reg)
    {
    case 0xA:
+      nes_irqsync();
       irq.counter &= ~0xFF;
       irq.counter |= value;
       break;
    
    case 0xB:
+      nes_irqsync();
       irq.counter = ((value & 0x7F) << 8) | (irq.counter & 0xFF);
       irq.enabled = (value & 0x80) ? true : false;
       break;
@@ -127,12 +160,13 @@ mapintf_t map19_intf =
    "Namcot 106", /* mapper name */
    map19_init, /* init routine */
    NULL, /* vblank callback */
-   NULL, /* hblank callback */
+   map19_hblank, /* hblank callback */
    map19_getstate, /* get state (snss) */
    map19_setstate, /* set state (snss) */
    NULL, /* memory read structure */
    map19_memwrite, /* memory write structure */
-   NULL /* external sound device */
+   NULL, /* external sound device */
+   map19_irqlines /* hblanks to next IRQ */
 };
 
 /*
@@ -57,8 +57,19 @@ static void map24_hblank(int vblank)
    }
 }
 
+static int map24_irqlines(void)
+{
+   if (false == irq.enabled)
+      return 0;
+
+   return 256 - irq.counter;
+}
+
 static void map24_write(uint32 address, uint8 value)
 {
+   if (address >= 0xF000)
+      nes_irqsync();
+
    switch (address & 0xF003)
    {
    case 0x8000:
@@ -182,7 +193,8 @@ mapintf_t map24_intf =
    map24_setstate, /* set state (snss) */
    NULL, /* memory read structure */
    map24_memwrite, /* memory write structure */
-   &vrcvi_ext /* external sound device */
+   &vrcvi_ext, /* external sound device */
+   map24_irqlines /* hblanks to next IRQ */
 };
 
 /*
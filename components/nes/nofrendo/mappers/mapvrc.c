@@ -55,6 +55,9 @@ static void vrc_init(void)
 
 static void map21_write(uint32 address, uint8 value)
 {
+   if (address >= 0xF000)
+      nes_irqsync();
+
    switch (address)
    {
    case 0x8000:
@@ -209,6 +212,9 @@ static void map22_write(uint32 address, uint8 value)
 
 static void map23_write(uint32 address, uint8 value)
 {
+   if (address >= 0xF000)
+      nes_irqsync();
+
    switch (address)
    {
    case 0x8000:
@@ -301,6 +307,14 @@ static void map23_write(uint32 address, uint8 value)
    }
 }
 
+static int vrc_irqlines(void)
+{
+   if (false == irq.enabled)
+      return 0;
+
+   return 256 - irq.counter;
+}
+
 static void vrc_hblank(int vblank) 
 {
    UNUSED(vblank);
@@ -360,7 +374,8 @@ mapintf_t map21_intf =
    map21_setstate, /* set state (snss) */
    NULL, /* memory read structure */
    map21_memwrite, /* memory write structure */
-   NULL /* external sound device */
+   NULL, /* external sound device */
+   vrc_irqlines /* hblanks to next IRQ */
 };
 
 mapintf_t map22_intf =
@@ -388,7 +403,8 @@ mapintf_t map23_intf =
    NULL, /* set state (snss) */
    NULL, /* memory read structure */
    map23_memwrite, /* memory write structure */
-   NULL /* external sound device */
+   NULL, /* external sound device */
+   vrc_irqlines /* hblanks to next IRQ */
 };
 
 mapintf_t map25_intf =
@@ -402,7 +418,8 @@ mapintf_t map25_intf =
    NULL, /* set state (snss) */
    NULL, /* memory read structure */
    map21_memwrite, /* memory write structure */
-   NULL /* external sound device */
+   NULL, /* external sound device */
+   vrc_irqlines /* hblanks to next IRQ */
 };
 
 /*
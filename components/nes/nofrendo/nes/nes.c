@@ -36,20 +36,30 @@
 #include <nes_ppu.h>
 #include <nes_rom.h>
 #include <nes_mmc.h>
+#include <nes_timing.h>
 #include <vid_drv.h>
 #include <nofrendo.h>
 #include "nesstate.h"
 
 #include "esp_system.h"
 
+#include "frame_exchange.h"
+#include "frame_policy.h"
+#include "display_pipeline.h"
+#include "i80_lcd.h"
+#include "rewind.h"
+#include "video_band.h"
+
 #define  NES_CLOCK_DIVIDER    12
 //#define  NES_MASTER_CLOCK     21477272.727272727272
 #define  NES_MASTER_CLOCK     (236250000 / 11)
-#define  NES_SCANLINE_CYCLES  (1364.0 / NES_CLOCK_DIVIDER)
 #define  NES_FIQ_PERIOD       (NES_MASTER_CLOCK / NES_CLOCK_DIVIDER / 60)
 
 #define  NES_RAMSIZE          0x800
 
+/* first scanline that makes it to the display */
+#define  NES_VISIBLE_TOP      ((NES_SCREEN_HEIGHT - NES_VISIBLE_HEIGHT) / 2)
+
 #define  NES_SKIP_LIMIT       (NES_REFRESH_RATE / 5)   /* 12 or 10, depending on PAL/NTSC */
 
 static nes_t nes;
@@ -295,43 +305,192 @@ void nes_nmi(void)
    nes6502_nmi();
 }
 
-static void nes_renderframe(bool draw_flag)
+/* cycle of the frame at which a scanline starts */
+#define  LINE_CYCLE(line)     NES_LINE_CYCLE(line, nes.frame_dots)
+
+/* how many times a frame the CPU was started, reset each time it's printed */
+static int cpu_slices = 0;
+
+static int nes_framecycles(void)
+{
+   return (int) (nes6502_getcycles(false) - nes.frame_cycle);
+}
+
+/* Bring the PPU up to the CPU: draw every line that has started by now.
+** The PPU calls this before anything the CPU or a mapper does to it takes
+** effect, so each line is drawn with the state it started with.
+*/
+void nes_catchup(void)
+{
+   int now;
+
+   /* nothing to draw between frames, and a mapper may switch banks
+   ** (and end up back here) while a line is being drawn
+   */
+   if (false == nes.in_frame || nes.catching_up)
+      return;
+
+   nes.catching_up = true;
+   now = nes_framecycles();
+
+   while (262 != nes.scanline && LINE_CYCLE(nes.scanline) <= now)
+   {
+      if (nes.scanline > 0)
+         ppu_endscanline(nes.scanline - 1);
+
+      ppu_scanline(nes.vidbuf, nes.scanline, nes.draw_flag,
+                   nes.frame_cycle + LINE_CYCLE(nes.scanline));
+
+      /* let the display follow along a band at a time */
+      if (nes.draw_flag && nes.scanline >= NES_VISIBLE_TOP
+          && nes.scanline < NES_VISIBLE_TOP + NES_VISIBLE_HEIGHT)
+      {
+         int line = nes.scanline - NES_VISIBLE_TOP;
+         if (NES_VISIBLE_HEIGHT - 1 == line)
+         {
+            /* the rest of the frame isn't shown, move to the next buffer */
+            frame_exchange_publish();
+            nes.vidbuf = osd_frame_bitmap();
+         }
+         else if (0 == ((line + 1) % VIDEO_BAND_LINES))
+         {
+            frame_exchange_lines_done(line + 1);
+         }
+      }
+
+      nes.scanline++;
+   }
+
+   nes.catching_up = false;
+}
+
+/* mappers with irq_lines get their hblanks here, whenever the CPU stops */
+#define  HBLANK_CYCLE(line)   (LINE_CYCLE(line) + ((241 == (line)) ? 7 : 0))
+
+static void nes_hblanks(void)
+{
+   mapintf_t *mapintf = nes.mmc->intf;
+   int now = nes_framecycles();
+
+   while (262 != nes.hblank_line && HBLANK_CYCLE(nes.hblank_line) <= now)
+   {
+      mapintf->hblank(nes.hblank_line >= 241);
+      nes.hblank_line++;
+   }
+}
+
+/* a mapper is about to change its IRQ counter: give it the hblanks it's
+** owed first, and have the CPU stop after this instruction so we look at
+** when the next IRQ can come again
+*/
+void nes_irqsync(void)
+{
+   if (false == nes.in_frame || NULL == nes.mmc->intf->irq_lines)
+      return;
+
+   nes_hblanks();
+   nes6502_release();
+}
+
+/* run the CPU up to a cycle of the frame */
+static void nes_runto(int cycle)
 {
-   int elapsed_cycles;
    mapintf_t *mapintf = nes.mmc->intf;
-   int in_vblank = 0;
+   int now = nes_framecycles();
 
-   while (262 != nes.scanline)
+   while (now < cycle)
    {
-      ppu_scanline(nes.vidbuf, nes.scanline, draw_flag);
+      int slice = cycle - now;
+      int elapsed_cycles;
+
+      /* stop for the frame IRQ */
+      if (0 == (nes.fiq_state & 0xC0) && nes.fiq_cycles > 0 && nes.fiq_cycles < slice)
+         slice = nes.fiq_cycles;
 
-      if (241 == nes.scanline)
+      /* and on the line a mapper IRQ could fire */
+      if (mapintf->irq_lines)
+      {
+         int irq_line, irq_cycle;
+
+         nes_hblanks();
+         irq_line = nes.hblank_line + mapintf->irq_lines() - 1;
+         if (irq_line >= nes.hblank_line && irq_line < 262)
+         {
+            irq_cycle = HBLANK_CYCLE(irq_line);
+            if (irq_cycle - now < slice)
+               slice = irq_cycle - now;
+         }
+      }
+
+      elapsed_cycles = nes6502_execute(slice);
+      nes_checkfiq(elapsed_cycles);
+      cpu_slices++;
+
+      /* jammed */
+      if (elapsed_cycles <= 0)
+         break;
+
+      now += elapsed_cycles;
+   }
+
+   if (mapintf->irq_lines)
+      nes_hblanks();
+}
+
+/* The CPU only stops for things that happen at a fixed time: the vblank
+** NMI, the frame IRQ, and mapper IRQs.  Mappers that can tell us when
+** their IRQ can fire next (irq_lines) only make it stop there, others
+** that count scanlines make it stop at the start of every line.  The PPU
+** is drawn lazily by nes_catchup(), whenever the game touches it and at
+** the end of the frame.  Sprite 0 hits need no stop of their own, reading
+** $2002 catches the PPU up first.
+*/
+static void nes_renderframe(bool draw_flag)
+{
+   mapintf_t *mapintf = nes.mmc->intf;
+   int line, frame_cycles;
+
+   /* a reset starts us in the middle of a frame */
+   line = nes.scanline;
+   nes.hblank_line = line;
+   nes.frame_cycle = nes6502_getcycles(false) - line * NES_SCANLINE_DOTS / NES_CPU_DOTS;
+   nes.draw_flag = draw_flag;
+   nes.in_frame = true;
+
+   while (262 != line)
+   {
+      if (241 == line)
       {
          /* 7-9 cycle delay between when VINT flag goes up and NMI is taken */
-         elapsed_cycles = nes6502_execute(7);
-         nes.scanline_cycles -= elapsed_cycles;
-         nes_checkfiq(elapsed_cycles);
+         nes_runto(LINE_CYCLE(241) + 7);
 
          ppu_checknmi();
 
          if (mapintf->vblank)
             mapintf->vblank();
-         in_vblank = 1;
       }
 
-      if (mapintf->hblank)
-         mapintf->hblank(in_vblank);
-
-      nes.scanline_cycles += (float) NES_SCANLINE_CYCLES;
-      elapsed_cycles = nes6502_execute((int) nes.scanline_cycles);
-      nes.scanline_cycles -= (float) elapsed_cycles;
-      nes_checkfiq(elapsed_cycles);
+      if (mapintf->hblank && NULL == mapintf->irq_lines)
+      {
+         mapintf->hblank(line >= 241);
+         line++;
+      }
+      else
+      {
+         line = (line < 241) ? 241 : 262;
+      }
 
-      ppu_endscanline(nes.scanline);
-      nes.scanline++;
+      nes_runto(LINE_CYCLE(line));
    }
 
+   /* draw whatever the game didn't make us draw already */
+   nes_catchup();
+   nes.in_frame = false;
    nes.scanline = 0;
+
+   /* carry what we ran over into the next frame */
+   frame_cycles = nes_framecycles();
+   nes.frame_dots = NES_CARRY_DOTS(nes.frame_dots, frame_cycles);
 }
 
 static void system_video(bool draw)
@@ -343,16 +502,11 @@ static void system_video(bool draw)
       return;
    }
 
-   /* blit the NES screen to our video surface */
-   vid_blit(nes.vidbuf, 0, (NES_SCREEN_HEIGHT - NES_VISIBLE_HEIGHT) / 2,
-            0, 0, NES_SCREEN_WIDTH, NES_VISIBLE_HEIGHT);
+   /* the frame already went out band by band from nes_renderframe */
 
    /* overlay our GUI on top of it */
    //gui_frame(true);
 
-   /* blit to screen */
-   vid_flush();
-
    /* grab input */
    osd_getinput();
 }
@@ -373,7 +527,7 @@ void nes_emulate(void)
 void nes_prep_emulation(char* filename, nes_t *machine) {
    osd_setsound(nes.apu->process);
 
-   nes.scanline_cycles = 0;
+   nes.frame_dots = 0;
    nes.fiq_cycles = (int) NES_FIQ_PERIOD;
 
    for (int i = 0; i < 4; ++i)
@@ -394,9 +548,8 @@ void nes_prep_emulation(char* filename, nes_t *machine) {
 void nes_emulateframe(unsigned char reset) {
    static float totalElapsedTime = 0;
    static int frame = 0;
-   static int skipFrame = 0;
    if (reset) {
-      frame = skipFrame = 0;
+      frame = 0;
       totalElapsedTime = 0;
    }
 
@@ -405,18 +558,16 @@ void nes_emulateframe(unsigned char reset) {
 
    gettimeofday(&tv_start, NULL);
 
-   // if skipframe is 0 or 2 we don't render
-   bool renderFrame = ((skipFrame % 2) == 0);
+   frame_policy_begin_frame();
+   bool renderFrame = frame_policy_should_render();
 
    nes_renderframe(renderFrame);
    system_video(renderFrame);
 
-   // if skipframe is 7 or 0, we increment
-   if (skipFrame % 7 == 0) ++skipFrame;
-   ++skipFrame;
-
    do_audio_frame();
 
+   frame_policy_end_frame();
+
    gettimeofday(&tv_stop, NULL);
 
    float time_sec = tv_stop.tv_sec - tv_start.tv_sec + 1e-6f * (tv_stop.tv_usec - tv_start.tv_usec);
@@ -426,10 +577,17 @@ void nes_emulateframe(unsigned char reset) {
    if (frame == 60) {
       float fps = frame / totalElapsedTime;
 
-      printf("HEAP:0x%lx, FPS:%f\n", esp_get_free_heap_size(), fps);
+      printf("HEAP:0x%lx, FPS:%f, CPU slices/frame:%d\n", esp_get_free_heap_size(), fps, cpu_slices / frame);
+      frame_policy_print_stats();
+      ppu_print_stats();
+      frame_exchange_print_stats();
+      display_pipeline_print_stats();
+      lcd_print_stats();
+      rewind_print_stats();
 
       frame = 0;
       totalElapsedTime = 0;
+      cpu_slices = 0;
    }
 }
 
@@ -466,11 +624,13 @@ void nes_destroy(nes_t **machine)
 {
    if (*machine)
    {
+      ppu_setchrmem(NULL, 0, NULL, 0);
       rom_free(&(*machine)->rominfo);
       mmc_destroy(&(*machine)->mmc);
       ppu_destroy(&(*machine)->ppu);
       apu_destroy(&(*machine)->apu);
-      bmp_destroy(&(*machine)->vidbuf);
+      /* vidbuf belongs to the osd frame exchange */
+      (*machine)->vidbuf = NULL;
       if ((*machine)->cpu)
       {
          if ((*machine)->cpu->mem_page[0])
@@ -520,12 +680,23 @@ int nes_insertcart(const char *filename, nes_t *machine)
    if (NULL != machine->rominfo->vram)
       machine->ppu->vram_present = true;
 
+   /* keep decoded copies of CHR-ROM / CHR-RAM (8kB banks) */
+   ppu_setchrmem(machine->rominfo->vrom, machine->rominfo->vrom_banks * 0x2000,
+                 machine->rominfo->vram, machine->rominfo->vrom_banks ? 0 : machine->rominfo->vram_banks * 0x2000);
+
    apu_setext(machine->apu, machine->mmc->intf->sound_ext);
 
    build_address_handlers(machine);
 
 
    nes_setcontext(machine);
+   nes6502_compilehandlers();
+#ifdef NES6502_MEMBENCH
+   nes6502_membench();
+#endif /* NES6502_MEMBENCH */
+#ifdef MMC_BANKBENCH
+   mmc_bankbench();
+#endif /* MMC_BANKBENCH */
 
    nes_reset(HARD_RESET);
 
@@ -551,8 +722,8 @@ nes_t *nes_create(void)
    memset(machine, 0, sizeof(nes_t));
 
    /* bitmap */
-   /* 8 pixel overdraw */
-   machine->vidbuf = bmp_create(NES_SCREEN_WIDTH, NES_SCREEN_HEIGHT, 8);
+   /* 8 pixel overdraw, rendered straight into the frame exchange */
+   machine->vidbuf = osd_frame_bitmap();
    if (NULL == machine->vidbuf)
       goto _fail;
 
@@ -76,10 +76,16 @@ typedef struct nes_s
    uint8 fiq_state;
    int fiq_cycles;
 
+   /* next line the PPU draws */
    int scanline;
+   /* next line whose hblank the mapper hasn't had */
+   int hblank_line;
 
    /* Timing stuff */
-   float scanline_cycles;
+   int frame_dots;         /* PPU dots owed to (or overrun into) this frame */
+   uint32 frame_cycle;     /* CPU cycle count the frame started at */
+   bool draw_flag;
+   bool in_frame, catching_up;
    bool autoframeskip;
 
    /* control */
@@ -103,6 +109,8 @@ extern void nes_destroy(nes_t **machine);
 extern int nes_insertcart(const char *filename, nes_t *machine);
 
 extern void nes_setfiq(uint8 state);
+extern void nes_catchup(void);
+extern void nes_irqsync(void);
 extern void nes_nmi(void);
 extern void nes_irq(void);
 extern void nes_emulate(void);
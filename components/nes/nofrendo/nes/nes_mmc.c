@@ -23,6 +23,7 @@
 ** $Id: nes_mmc.c,v 1.2 2001/04/27 14:37:11 neil Exp $
 */
 
+#include <stdlib.h>
 #include <string.h>
 #include <noftypes.h>
 #include "nes6502.h"
@@ -32,7 +33,14 @@
 #include <log.h>
 #include <mmclist.h>
 #include <nes_rom.h>
-//#include <stdlib.h>
+
+#ifdef MMC_BANKBENCH
+#include <stdio.h>
+#include <sys/time.h>
+#ifndef MMC_BANKBENCH_LOOPS
+#define  MMC_BANKBENCH_LOOPS  100000
+#endif /* !MMC_BANKBENCH_LOOPS */
+#endif /* MMC_BANKBENCH */
 
 #define  MMC_8KROM         (mmc.cart->rom_banks * 2)
 #define  MMC_16KROM        (mmc.cart->rom_banks)
@@ -69,6 +77,43 @@ void mmc_getcontext(mmc_t *dest_mmc)
    *dest_mmc = mmc;
 }
 
+/* Where each 8K ROM / 1K VROM bank number lands, worked out once per cart.
+** Bigger banks are whole runs of these (a 16K bank b is 8K bank 2b, wrapped
+** the same way), so every bank size shares one table and nobody divides on
+** a bank switch.  Bank numbers past the end of a table wrap the slow way.
+*/
+#define  MMC_BANKTABLE     256
+
+static uint8 *rom_bank[MMC_BANKTABLE];
+static uint8 *vrom_bank[MMC_BANKTABLE];
+
+static void mmc_buildbanks(void)
+{
+   int i;
+
+   for (i = 0; i < MMC_BANKTABLE; i++)
+   {
+      rom_bank[i] = &mmc.cart->rom[(i % MMC_8KROM) << 13];
+      vrom_bank[i] = mmc.cart->vrom_banks ? &mmc.cart->vrom[(i % MMC_1KVROM) << 10] : NULL;
+   }
+}
+
+INLINE uint8 *mmc_rombank(int bank)
+{
+   if ((unsigned) bank < MMC_BANKTABLE)
+      return rom_bank[bank];
+
+   return &mmc.cart->rom[(bank % MMC_8KROM) << 13];
+}
+
+INLINE uint8 *mmc_vrombank(int bank)
+{
+   if ((unsigned) bank < MMC_BANKTABLE)
+      return vrom_bank[bank];
+
+   return &mmc.cart->vrom[(bank % MMC_1KVROM) << 10];
+}
+
 /* VROM bankswitching */
 void mmc_bankvrom(int size, uint32 address, int bank)
 {
@@ -80,25 +125,25 @@ void mmc_bankvrom(int size, uint32 address, int bank)
    case 1:
       if (bank == MMC_LASTBANK)
          bank = MMC_LAST1KVROM;
-      ppu_setpage(1, address >> 10, &mmc.cart->vrom[(bank % MMC_1KVROM) << 10] - address);
+      ppu_setpage(1, address >> 10, mmc_vrombank(bank) - address);
       break;
 
    case 2:
       if (bank == MMC_LASTBANK)
          bank = MMC_LAST2KVROM;
-      ppu_setpage(2, address >> 10, &mmc.cart->vrom[(bank % MMC_2KVROM) << 11] - address);
+      ppu_setpage(2, address >> 10, mmc_vrombank(bank * 2) - address);
       break;
 
    case 4:
       if (bank == MMC_LASTBANK)
          bank = MMC_LAST4KVROM;
-      ppu_setpage(4, address >> 10, &mmc.cart->vrom[(bank % MMC_4KVROM) << 12] - address);
+      ppu_setpage(4, address >> 10, mmc_vrombank(bank * 4) - address);
       break;
 
    case 8:
       if (bank == MMC_LASTBANK)
          bank = MMC_LAST8KVROM;
-      ppu_setpage(8, 0, &mmc.cart->vrom[(bank % MMC_8KVROM) << 13]);
+      ppu_setpage(8, 0, mmc_vrombank(bank * 8));
       break;
 
    default:
@@ -111,47 +156,27 @@ void mmc_bankvrom(int size, uint32 address, int bank)
 /* ROM bankswitching */
 void mmc_bankrom(int size, uint32 address, int bank)
 {
-   nes6502_context mmc_cpu;
-
-   nes6502_getcontext(&mmc_cpu);
+   int page = address >> NES6502_BANKSHIFT;
 
    switch (size)
    {
    case 8:
       if (bank == MMC_LASTBANK)
          bank = MMC_LAST8KROM;
-      {
-         int page = address >> NES6502_BANKSHIFT;
-         mmc_cpu.mem_page[page] = &mmc.cart->rom[(bank % MMC_8KROM) << 13];
-         mmc_cpu.mem_page[page + 1] = mmc_cpu.mem_page[page] + 0x1000;
-      }
-
+      nes6502_setbanks(page, 2, mmc_rombank(bank));
       break;
 
    case 16:
       if (bank == MMC_LASTBANK)
          bank = MMC_LAST16KROM;
-      {
-         int page = address >> NES6502_BANKSHIFT;
-         mmc_cpu.mem_page[page] = &mmc.cart->rom[(bank % MMC_16KROM) << 14];
-         mmc_cpu.mem_page[page + 1] = mmc_cpu.mem_page[page] + 0x1000;
-         mmc_cpu.mem_page[page + 2] = mmc_cpu.mem_page[page] + 0x2000;
-         mmc_cpu.mem_page[page + 3] = mmc_cpu.mem_page[page] + 0x3000;
-      }
+      nes6502_setbanks(page, 4, mmc_rombank(bank * 2));
       break;
 
    case 32:
       if (bank == MMC_LASTBANK)
          bank = MMC_LAST32KROM;
-
-      mmc_cpu.mem_page[8] = &mmc.cart->rom[(bank % MMC_32KROM) << 15];
-      mmc_cpu.mem_page[9] = mmc_cpu.mem_page[8] + 0x1000;
-      mmc_cpu.mem_page[10] = mmc_cpu.mem_page[8] + 0x2000;
-      mmc_cpu.mem_page[11] = mmc_cpu.mem_page[8] + 0x3000;
-      mmc_cpu.mem_page[12] = mmc_cpu.mem_page[8] + 0x4000;
-      mmc_cpu.mem_page[13] = mmc_cpu.mem_page[8] + 0x5000;
-      mmc_cpu.mem_page[14] = mmc_cpu.mem_page[8] + 0x6000;
-      mmc_cpu.mem_page[15] = mmc_cpu.mem_page[8] + 0x7000;
+      /* an odd number of 16K banks doesn't split into 32K ones evenly */
+      nes6502_setbanks(8, 8, mmc_rombank((bank % MMC_32KROM) * 4));
       break;
 
    default:
@@ -159,10 +184,56 @@ void mmc_bankrom(int size, uint32 address, int bank)
       //abort();
       break;
    }
+}
+
+#ifdef MMC_BANKBENCH
+/* the bank switch used before nes6502_setbanks(), for comparison */
+static void mmc_bankrom_context(int bank)
+{
+   nes6502_context mmc_cpu;
 
+   nes6502_getcontext(&mmc_cpu);
+   mmc_cpu.mem_page[8] = &mmc.cart->rom[(bank % MMC_8KROM) << 13];
+   mmc_cpu.mem_page[9] = mmc_cpu.mem_page[8] + 0x1000;
    nes6502_setcontext(&mmc_cpu);
 }
 
+static uint32 bankbench_usec(void)
+{
+   struct timeval tv;
+
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* time 8K switches at $8000 both ways, then put the memory map back */
+void mmc_bankbench(void)
+{
+   const int loops = MMC_BANKBENCH_LOOPS;
+   nes6502_context saved;
+   uint32 start, context_usec, direct_usec;
+   int i;
+
+   nes6502_getcontext(&saved);
+
+   start = bankbench_usec();
+   for (i = 0; i < loops; i++)
+      mmc_bankrom_context(i);
+   context_usec = bankbench_usec() - start;
+
+   start = bankbench_usec();
+   for (i = 0; i < loops; i++)
+      mmc_bankrom(8, 0x8000, i & (MMC_BANKTABLE - 1));
+   direct_usec = bankbench_usec() - start;
+
+   nes6502_setcontext(&saved);
+
+   printf("mmc: %u bank switches/s through the CPU context, %u in place\n",
+          (uint32) (1000000.0 * loops / (context_usec ? context_usec : 1)),
+          (uint32) (1000000.0 * loops / (direct_usec ? direct_usec : 1)));
+}
+#endif /* MMC_BANKBENCH */
+
 /* Check to see if this mapper is supported */
 bool mmc_peek(int map_num)
 {
@@ -252,6 +323,7 @@ mmc_t *mmc_create(rominfo_t *rominfo)
    temp->cart = rominfo;
 
    mmc_setcontext(temp);
+   mmc_buildbanks();
 
    log_printf("created memory mapper: %s\n", (*map_ptr)->name);
 
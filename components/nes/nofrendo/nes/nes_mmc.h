@@ -31,6 +31,9 @@
 
 #define  MMC_LASTBANK      -1
 
+/* Define this to time bank switches when a cart is inserted */
+/*#define  MMC_BANKBENCH*/
+
 typedef struct
 {
    uint32 min_range, max_range;
@@ -56,6 +59,13 @@ typedef struct mapintf_s
    map_memread *mem_read;
    map_memwrite *mem_write;
    apuext_t *sound_ext;
+   /* For IRQ counters driven by hblank: at least how many more hblanks go
+   ** by before the mapper can raise an IRQ, 0 if it can't until the game
+   ** writes to it.  Mappers that have this get their hblank callbacks in a
+   ** batch whenever the CPU stops instead of the CPU stopping every line,
+   ** and must call nes_irqsync() before writes that change the counter.
+   */
+   int (*irq_lines)(void);
 } mapintf_t;
 
 
@@ -79,6 +89,9 @@ extern void mmc_getcontext(mmc_t *dest_mmc);
 extern void mmc_setcontext(mmc_t *src_mmc);
 
 extern bool mmc_peek(int map_num);
+#ifdef MMC_BANKBENCH
+extern void mmc_bankbench(void);
+#endif /* MMC_BANKBENCH */
 
 extern void mmc_reset(void);
 
@@ -23,6 +23,7 @@
 ** $Id: nes_ppu.c,v 1.2 2001/04/27 14:37:11 neil Exp $
 */
 
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <noftypes.h>
@@ -37,6 +38,8 @@
 #include <nes_pal.h>
 #include <nesinput.h>
 
+#include "esp_timer.h"
+
 
 /* PPU access */
 #define  PPU_MEM(x)           ppu.page[(x) >> 10][(x)]
@@ -54,6 +57,244 @@
 /* the NES PPU */
 static ppu_t ppu;
 
+/* CPU cycle count the line being drawn started at (lines are drawn late) */
+static uint32 line_cycle;
+
+/* Decoded CHR: for every pattern row (the two bitplane bytes of one line of
+** a tile) the 16 bit interleave that draw_bgrow() works from, kept in a copy
+** laid out alongside CHR-ROM / CHR-RAM.  CHR-ROM is decoded once when the
+** cart goes in, CHR-RAM a row at a time as the game writes it.  chr_page[]
+** shadows ppu.page[0-7] (biased the same way, so it is indexed by PPU
+** address) and is NULL for pages that point anywhere else.
+*/
+#define  CHR_REGIONS          2
+#define  CHR_ROW(x)           ((((x) >> 4) << 3) | ((x) & 7))
+
+typedef struct chr_region_s
+{
+   uint8 *mem;
+   uint16 *rows;
+   int size;
+} chr_region_t;
+
+static chr_region_t chr_region[CHR_REGIONS];
+static uint16 *chr_page[8];
+
+INLINE uint16 chr_interleave(uint8 pat1, uint8 pat2)
+{
+   return ((pat2 & 0xAA) << 8) | ((pat2 & 0x55) << 1)
+          | ((pat1 & 0xAA) << 7) | (pat1 & 0x55);
+}
+
+static void chr_decoderegion(chr_region_t *region)
+{
+   int offset;
+
+   if (NULL == region->rows)
+      return;
+
+   for (offset = 0; offset < region->size; offset++)
+   {
+      if (offset & 8)
+         continue; /* second bitplane */
+      region->rows[CHR_ROW(offset)] = chr_interleave(region->mem[offset], region->mem[offset + 8]);
+   }
+}
+
+static void chr_setregion(chr_region_t *region, uint8 *mem, int size)
+{
+   if (region->rows)
+      free(region->rows);
+
+   region->mem = mem;
+   region->size = size;
+   region->rows = NULL;
+
+   if (NULL == mem || 0 == size)
+      return;
+
+   /* 2 bytes of decoded row per 2 bytes of pattern data */
+   region->rows = _my_malloc(size);
+   if (NULL == region->rows)
+   {
+      log_printf("ppu: no memory for decoded CHR, decoding on the fly\n");
+      return;
+   }
+
+   chr_decoderegion(region);
+}
+
+static void chr_mappage(int page)
+{
+   uint8 *location = ppu.page[page] + (page << 10);
+   int i;
+
+   chr_page[page] = NULL;
+
+   for (i = 0; i < CHR_REGIONS; i++)
+   {
+      chr_region_t *region = &chr_region[i];
+
+      if (region->rows && location >= region->mem
+          && location + 0x400 <= region->mem + region->size)
+      {
+         chr_page[page] = region->rows + ((location - region->mem) >> 1) - (page << 9);
+         break;
+      }
+   }
+}
+
+/* decoded row at a pattern address */
+INLINE uint32 chr_row(uint32 address)
+{
+   uint16 *rows = chr_page[address >> 10];
+   uint8 *data;
+
+   if (rows)
+      return rows[CHR_ROW(address)];
+
+   data = &PPU_MEM(address);
+   return chr_interleave(data[0], data[8]);
+}
+
+/* OAM entry */
+typedef struct obj_s
+{
+   uint8 y_loc;
+   uint8 tile;
+   uint8 atr;
+   uint8 x_loc;
+} obj_t;
+
+/* Sprite bins: the sprites on each scanline (in OAM order, at most
+** PPU_MAXSPRITE of them) and the row of their tile each one shows there,
+** vertical flip already applied.  They only depend on OAM and the sprite
+** size, so they are rebuilt the first time a scanline looks at them after
+** either changed -- for most games once a frame, after the OAM DMA.
+*/
+typedef struct oam_slot_s
+{
+   uint8 sprite;  /* index into OAM */
+   uint8 row;     /* offset from the tile's pattern address */
+} oam_slot_t;
+
+static oam_slot_t oam_bin[240][PPU_MAXSPRITE];
+static uint8 oam_bincount[240];
+static bool oam_dirty = true;
+
+/* sprite stats, reset each time they are printed */
+static int oam_rebuilds = 0;
+static int oam_lines = 0;
+static int oam_sprites = 0;
+static int64_t oam_time = 0;
+
+static void oam_binsprites(void)
+{
+   obj_t *sprite_ptr = (obj_t *) ppu.oam;
+   int sprite_num, first, last, line;
+
+   memset(oam_bincount, 0, sizeof(oam_bincount));
+
+   for (sprite_num = 0; sprite_num < 64; sprite_num++, sprite_ptr++)
+   {
+      /* y_loc of $EF-$FF puts the sprite below the screen */
+      first = sprite_ptr->y_loc + 1;
+      if (first >= 240)
+         continue;
+
+      last = first + ppu.obj_height;
+      if (last > 240)
+         last = 240;
+
+      for (line = first; line < last; line++)
+      {
+         oam_slot_t *slot;
+         int y_offset;
+
+         if (PPU_MAXSPRITE == oam_bincount[line])
+            continue;
+
+         /* the second half of an 8x16 sprite is the next tile */
+         y_offset = line - first;
+         if (y_offset > 7)
+            y_offset += 8;
+
+         if (sprite_ptr->atr & OAMF_VFLIP)
+            y_offset = ((16 == ppu.obj_height) ? 23 : 7) - y_offset;
+
+         slot = &oam_bin[line][oam_bincount[line]++];
+         slot->sprite = sprite_num;
+         slot->row = y_offset;
+      }
+   }
+
+   oam_dirty = false;
+   oam_rebuilds++;
+}
+
+INLINE int oam_scanline(int scanline)
+{
+   if (oam_dirty)
+      oam_binsprites();
+
+   return oam_bincount[scanline];
+}
+
+/* pattern address of the row a binned sprite shows */
+INLINE uint32 oam_rowaddr(const obj_t *sprite_ptr, const oam_slot_t *slot)
+{
+   uint8 tile_index = sprite_ptr->tile;
+
+   /* 8x16 even sprites use $0000, odd use $1000 */
+   if (16 == ppu.obj_height)
+      return ((tile_index & 1) << 12) + ((tile_index & 0xFE) << 4) + slot->row;
+   else
+      return ppu.obj_base + (tile_index << 4) + slot->row;
+}
+
+void ppu_print_stats(void)
+{
+   printf("ppu sprites: %d lines, %.2f sprites / %.2f us per line, %d bin rebuilds\n",
+          oam_lines,
+          oam_lines ? (float) oam_sprites / oam_lines : 0.0f,
+          oam_lines ? (float) oam_time / oam_lines : 0.0f,
+          oam_rebuilds);
+   oam_rebuilds = 0;
+   oam_lines = 0;
+   oam_sprites = 0;
+   oam_time = 0;
+}
+
+/* keep the decoded row in step after a write to pattern memory */
+INLINE void chr_written(uint32 address)
+{
+   uint16 *rows = chr_page[address >> 10];
+
+   if (rows)
+   {
+      uint8 *data = &PPU_MEM(address & ~8);
+      rows[CHR_ROW(address)] = chr_interleave(data[0], data[8]);
+   }
+}
+
+/* tell the PPU where CHR-ROM / CHR-RAM live, so it can keep them decoded */
+void ppu_setchrmem(uint8 *vrom, int vrom_size, uint8 *vram, int vram_size)
+{
+   int page;
+
+   chr_setregion(&chr_region[0], vrom, vrom_size);
+   chr_setregion(&chr_region[1], vram, vram_size);
+
+   for (page = 0; page < 8; page++)
+      chr_mappage(page);
+}
+
+/* CHR-RAM was changed behind our back (state load) */
+void ppu_refreshchr(void)
+{
+   chr_decoderegion(&chr_region[1]);
+}
+
 
 void ppu_displaysprites(bool display)
 {
@@ -62,7 +303,7 @@ void ppu_displaysprites(bool display)
 
 void ppu_setcontext(ppu_t *src_ppu)
 {
-   int nametab[4];
+   int nametab[4], i;
    ASSERT(src_ppu);
    ppu = *src_ppu;
 
@@ -87,6 +328,11 @@ void ppu_setcontext(ppu_t *src_ppu)
    ppu.page[13] = ppu.page[9] - 0x1000;
    ppu.page[14] = ppu.page[10] - 0x1000;
    ppu.page[15] = ppu.page[11] - 0x1000;
+
+   for (i = 0; i < 8; i++)
+      chr_mappage(i);
+
+   oam_dirty = true;
 }
 
 void ppu_getcontext(ppu_t *dest_ppu)
@@ -158,6 +404,10 @@ void ppu_destroy(ppu_t **src_ppu)
 
 void ppu_setpage(int size, int page_num, uint8 *location)
 {
+   int first_page = page_num;
+
+   nes_catchup();
+
    /* deliberately fall through */
    switch (size)
    {
@@ -175,11 +425,16 @@ void ppu_setpage(int size, int page_num, uint8 *location)
       ppu.page[page_num++] = location;
       break;
    }
+
+   /* point the pattern pages at their decoded rows */
+   for (; first_page < page_num && first_page < 8; first_page++)
+      chr_mappage(first_page);
 }
 
 /* make sure $3000-$3F00 mirrors $2000-$2F00 */
 void ppu_mirrorhipages(void)
 {
+   nes_catchup();
    ppu.page[12] = ppu.page[8] - 0x1000;
    ppu.page[13] = ppu.page[9] - 0x1000;
    ppu.page[14] = ppu.page[10] - 0x1000;
@@ -188,6 +443,7 @@ void ppu_mirrorhipages(void)
 
 void ppu_mirror(int nt1, int nt2, int nt3, int nt4)
 {
+   nes_catchup();
    ppu.page[8] = ppu.nametab + (nt1 << 10) - 0x2000;
    ppu.page[9] = ppu.nametab + (nt2 << 10) - 0x2400;
    ppu.page[10] = ppu.nametab + (nt3 << 10) - 0x2800;
@@ -217,6 +473,7 @@ void ppu_reset(int reset_type)
 {
    if (HARD_RESET == reset_type)
       mem_trash(ppu.oam, 256);
+   oam_dirty = true;
 
    ppu.ctrl0 = 0;
    ppu.ctrl1 = PPU_CTRL1F_OBJON | PPU_CTRL1F_BGON;
@@ -241,46 +498,46 @@ static void ppu_setstrike(int x_loc)
       ppu.strikeflag = true;
 
       /* 3 pixels per cpu cycle */
-      ppu.strike_cycle = nes6502_getcycles(false) + (x_loc / 3);
+      ppu.strike_cycle = line_cycle + (x_loc / 3);
    }
 }
 
 static void ppu_oamdma(uint8 value)
 {
-   uint32 cpu_address;
+   const uint8 *src;
    uint8 oam_loc;
 
-   cpu_address = (uint32) (value << 8);
+   nes_catchup();
+
+   /* the 2K of RAM is mirrored up to $1FFF */
+   if (value < 0x20)
+      value &= 0x07;
+
+   /* the page is copied straight out of memory, like nes6502_getbyte() */
+   src = nes6502_getpage(value << 8);
 
    /* Sprite DMA starts at the current SPRRAM address */
    oam_loc = ppu.oam_addr;
-   do
-   {
-      ppu.oam[oam_loc++] = nes6502_getbyte(cpu_address++);
-   }
-   while (oam_loc != ppu.oam_addr);
+   memcpy(ppu.oam + oam_loc, src, 256 - oam_loc);
+   memcpy(ppu.oam, src + 256 - oam_loc, oam_loc);
 
    /* TODO: enough with houdini */
-   cpu_address -= 256;
    /* Odd address in $2003 */
    if ((ppu.oam_addr >> 2) & 1)
    {
-      for (oam_loc = 4; oam_loc < 8; oam_loc++)
-         ppu.oam[oam_loc] = nes6502_getbyte(cpu_address++);
-      cpu_address += 248;
-      for (oam_loc = 0; oam_loc < 4; oam_loc++)
-         ppu.oam[oam_loc] = nes6502_getbyte(cpu_address++);
+      memcpy(ppu.oam + 4, src, 4);
+      memcpy(ppu.oam, src + 252, 4);
    }
    /* Even address in $2003 */
    else
    {
-      for (oam_loc = 0; oam_loc < 8; oam_loc++)
-         ppu.oam[oam_loc] = nes6502_getbyte(cpu_address++);
+      memcpy(ppu.oam, src, 8);
    }
 
-   /* make the CPU spin for DMA cycles */
-   nes6502_burn(513);
-   nes6502_release();
+   oam_dirty = true;
+
+   /* the CPU is stalled for 513 cycles, 514 when DMA starts on an odd one */
+   nes6502_stall(513 + (nes6502_getcycles(false) & 1));
 }
 
 /* TODO: this isn't the PPU! */
@@ -346,6 +603,8 @@ uint8 ppu_read(uint32 address)
 {
    uint8 value;
 
+   nes_catchup();
+
    /* handle mirrored reads up to $3FFF */
    switch (address & 0x2007)
    {
@@ -403,6 +662,8 @@ uint8 ppu_read(uint32 address)
 /* Write to $2000-$2007 */
 void ppu_write(uint32 address, uint8 value)
 {
+   nes_catchup();
+
    /* write goes into ppu latch... */
    ppu.latch = value;
 
@@ -411,6 +672,8 @@ void ppu_write(uint32 address, uint8 value)
    case PPU_CTRL0:
       ppu.ctrl0 = value;
 
+      if (ppu.obj_height != ((value & PPU_CTRL0F_OBJ16) ? 16 : 8))
+         oam_dirty = true;
       ppu.obj_height = (value & PPU_CTRL0F_OBJ16) ? 16 : 8;
       ppu.bg_base = (value & PPU_CTRL0F_BGADDR) ? 0x1000 : 0;
       ppu.obj_base = (value & PPU_CTRL0F_OBJADDR) ? 0x1000 : 0;
@@ -423,6 +686,8 @@ void ppu_write(uint32 address, uint8 value)
       break;
 
    case PPU_CTRL1:
+      /* scanline counters only count while the PPU is on */
+      nes_irqsync();
       ppu.ctrl1 = value;
 
       ppu.obj_on = (value & PPU_CTRL1F_OBJON) ? true : false;
@@ -437,6 +702,7 @@ void ppu_write(uint32 address, uint8 value)
 
    case PPU_OAMDATA:
       ppu.oam[ppu.oam_addr++] = value;
+      oam_dirty = true;
       break;
 
    case PPU_SCROLL:
@@ -487,6 +753,8 @@ void ppu_write(uint32 address, uint8 value)
             log_printf("VRAM write to $%04X, scanline %d\n",
                        ppu.vaddr, nes_getcontextptr()->scanline);
             PPU_MEM(ppu.vaddr) = 0xFF; /* corrupt */
+            if (ppu.vaddr < 0x2000)
+               chr_written(ppu.vaddr);
          }
          else
          {
@@ -496,6 +764,8 @@ void ppu_write(uint32 address, uint8 value)
                ppu.vaddr -= 0x1000;
 
             PPU_MEM(addr) = value;
+            if (addr < 0x2000)
+               chr_written(addr);
          }
       }
       else
@@ -568,12 +838,8 @@ void ppu_setvromswitch(ppuvromswitch_t func)
 }
 
 /* rendering routines */
-INLINE void draw_bgtile(uint8 *surface, uint8 pat1, uint8 pat2,
-                        const uint8 *colors)
+INLINE void draw_bgrow(uint8 *surface, uint32 pattern, const uint8 *colors)
 {
-   uint32 pattern = ((pat2 & 0xAA) << 8) | ((pat2 & 0x55) << 1)
-                    | ((pat1 & 0xAA) << 7) | (pat1 & 0x55);
-
    *surface++ = colors[(pattern >> 14) & 3];
    *surface++ = colors[(pattern >> 6) & 3];
    *surface++ = colors[(pattern >> 12) & 3];
@@ -584,12 +850,10 @@ INLINE void draw_bgtile(uint8 *surface, uint8 pat1, uint8 pat2,
    *surface = colors[pattern & 3];
 }
 
-INLINE int draw_oamtile(uint8 *surface, uint8 attrib, uint8 pat1,
-                        uint8 pat2, const uint8 *col_tbl, bool check_strike)
+INLINE int draw_oamtile(uint8 *surface, uint8 attrib, uint32 color,
+                        const uint8 *col_tbl, bool check_strike)
 {
    int strike_pixel = -1;
-   uint32 color = ((pat2 & 0xAA) << 8) | ((pat2 & 0x55) << 1)
-                  | ((pat1 & 0xAA) << 7) | (pat1 & 0x55);
 
    /* sprite is not 100% transparent */
    if (color)
@@ -687,8 +951,8 @@ INLINE int draw_oamtile(uint8 *surface, uint8 attrib, uint8 pat1,
 
 static void ppu_renderbg(uint8 *vidbuf)
 {
-   uint8 *bmp_ptr, *data_ptr, *tile_ptr, *attrib_ptr;
-   uint32 refresh_vaddr, bg_offset, attrib_base;
+   uint8 *bmp_ptr, *tile_ptr, *attrib_ptr;
+   uint32 refresh_vaddr, bg_offset, attrib_base, pattern_addr, pattern;
    int tile_count;
    uint8 tile_index, x_tile, y_tile;
    uint8 col_high, attrib, attrib_shift;
@@ -720,13 +984,15 @@ static void ppu_renderbg(uint8 *vidbuf)
    {
       /* Tile number from nametable */
       tile_index = *tile_ptr++;
-      data_ptr = &PPU_MEM(bg_offset + (tile_index << 4));
+      pattern_addr = bg_offset + (tile_index << 4);
+
+      pattern = chr_row(pattern_addr);
 
       /* Handle $FD/$FE tile VROM switching (PunchOut) */
       if (ppu.latchfunc)
          ppu.latchfunc(ppu.bg_base, tile_index);
 
-      draw_bgtile(bmp_ptr, data_ptr[0], data_ptr[8], ppu.palette + col_high);
+      draw_bgrow(bmp_ptr, pattern, ppu.palette + col_high);
       bmp_ptr += 8;
 
       x_tile++;
@@ -766,28 +1032,24 @@ static void ppu_renderbg(uint8 *vidbuf)
    }
 }
 
-/* OAM entry */
-typedef struct obj_s
-{
-   uint8 y_loc;
-   uint8 tile;
-   uint8 atr;
-   uint8 x_loc;
-} obj_t;
-
 /* TODO: fetch valid OAM a scanline before, like the Real Thing */
 static void ppu_renderoam(uint8 *vidbuf, int scanline)
 {
    uint8 *buf_ptr;
-   uint32 vram_offset;
    uint32 savecol[2] = {0, 0};
-   int sprite_num, spritecount;
-   obj_t *sprite_ptr;
-   uint8 sprite_height;
+   int slot_num, spritecount;
+   const oam_slot_t *slot;
+   int64_t start;
 
    if (false == ppu.obj_on)
       return;
 
+   spritecount = oam_scanline(scanline);
+   if (0 == spritecount)
+      return;
+
+   start = esp_timer_get_time();
+
    /* Get our buffer pointer */
    buf_ptr = vidbuf;
 
@@ -798,157 +1060,77 @@ static void ppu_renderoam(uint8 *vidbuf, int scanline)
       savecol[1] = ((uint32 *) buf_ptr)[1];
    }
 
-   sprite_height = ppu.obj_height;
-   vram_offset = ppu.obj_base;
-   spritecount = 0;
-
-   sprite_ptr = (obj_t *) ppu.oam;
+   slot = oam_bin[scanline];
 
-   for (sprite_num = 0; sprite_num < 64; sprite_num++, sprite_ptr++)
+   for (slot_num = 0; slot_num < spritecount; slot_num++, slot++)
    {
-      uint8 *data_ptr, *bmp_ptr;
-      uint32 vram_adr;
-      int y_offset;
-      uint8 tile_index, attrib, col_high;
-      uint8 sprite_y, sprite_x;
+      obj_t *sprite_ptr = (obj_t *) ppu.oam + slot->sprite;
+      uint32 color;
+      uint8 attrib, col_high;
       bool check_strike;
       int strike_pixel;
 
-      sprite_y = sprite_ptr->y_loc + 1;
-
-      /* Check to see if sprite is out of range */
-      if ((sprite_y > scanline) || (sprite_y <= (scanline - sprite_height))
-          || (0 == sprite_y) || (sprite_y >= 240))
-         continue;
-
-      sprite_x = sprite_ptr->x_loc;
-      tile_index = sprite_ptr->tile;
       attrib = sprite_ptr->atr;
 
-      bmp_ptr = buf_ptr + sprite_x;
-
       /* Handle $FD/$FE tile VROM switching (PunchOut) */
       if (ppu.latchfunc)
-         ppu.latchfunc(vram_offset, tile_index);
+         ppu.latchfunc(ppu.obj_base, sprite_ptr->tile);
 
       /* Get upper two bits of color */
       col_high = ((attrib & 3) << 2);
 
-      /* 8x16 even sprites use $0000, odd use $1000 */
-      if (16 == ppu.obj_height)
-         vram_adr = ((tile_index & 1) << 12) | ((tile_index & 0xFE) << 4);
-      else
-         vram_adr = vram_offset + (tile_index << 4);
-
-      /* Get the address of the tile */
-      data_ptr = &PPU_MEM(vram_adr);
-
-      /* Calculate offset (line within the sprite) */
-      y_offset = scanline - sprite_y;
-      if (y_offset > 7)
-         y_offset += 8;
-
-      /* Account for vertical flippage */
-      if (attrib & OAMF_VFLIP)
-      {
-         if (16 == ppu.obj_height)
-            y_offset -= 23;
-         else
-            y_offset -= 7;
-
-         data_ptr -= y_offset;
-      }
-      else
-      {
-         data_ptr += y_offset;
-      }
+      color = chr_row(oam_rowaddr(sprite_ptr, slot));
 
       /* if we're on sprite 0 and sprite 0 strike flag isn't set,
       ** check for a strike
       */
-      check_strike = (0 == sprite_num) && (false == ppu.strikeflag);
-      strike_pixel = draw_oamtile(bmp_ptr, attrib, data_ptr[0], data_ptr[8], ppu.palette + 16 + col_high, check_strike);
+      check_strike = (0 == slot->sprite) && (false == ppu.strikeflag);
+      strike_pixel = draw_oamtile(buf_ptr + sprite_ptr->x_loc, attrib, color, ppu.palette + 16 + col_high, check_strike);
       if (strike_pixel >= 0)
          ppu_setstrike(strike_pixel);
-
-      /* maximum of 8 sprites per scanline */
-      if (++spritecount == PPU_MAXSPRITE)
-      {
-         ppu.stat |= PPU_STATF_MAXSPRITE;
-         break;
-      }
    }
 
+   /* maximum of 8 sprites per scanline */
+   if (PPU_MAXSPRITE == spritecount)
+      ppu.stat |= PPU_STATF_MAXSPRITE;
+
    /* Restore lefthand column */
    if (ppu.obj_mask)
    {
       ((uint32 *) buf_ptr)[0] = savecol[0];
       ((uint32 *) buf_ptr)[1] = savecol[1];
    }
+
+   oam_lines++;
+   oam_sprites += spritecount;
+   oam_time += esp_timer_get_time() - start;
 }
 
 /* Fake rendering a line */
 /* This is needed for sprite 0 hits when we're skipping drawing a frame */
 static void ppu_fakeoam(int scanline)
 {
-   uint8 *data_ptr;
+   const oam_slot_t *slot;
    obj_t *sprite_ptr;
-   uint32 vram_adr, color;
-   int y_offset;
-   uint8 pat1, pat2;
-   uint8 tile_index, attrib;
-   uint8 sprite_height, sprite_y, sprite_x;
+   uint32 color;
+   uint8 attrib, sprite_x;
 
    /* we don't need to be here if strike flag is set */
 
    if (false == ppu.obj_on || ppu.strikeflag)
       return;
 
-   sprite_height = ppu.obj_height;
-   sprite_ptr = (obj_t *) ppu.oam;
-   sprite_y = sprite_ptr->y_loc + 1;
-
-   /* Check to see if sprite is out of range */
-   if ((sprite_y > scanline) || (sprite_y <= (scanline - sprite_height))
-       || (0 == sprite_y) || (sprite_y > 240))
+   /* sprite 0 is always binned first when it is on the line */
+   slot = oam_bin[scanline];
+   if (0 == oam_scanline(scanline) || 0 != slot->sprite)
       return;
 
+   sprite_ptr = (obj_t *) ppu.oam;
    sprite_x = sprite_ptr->x_loc;
-   tile_index = sprite_ptr->tile;
    attrib = sprite_ptr->atr;
 
-   /* 8x16 even sprites use $0000, odd use $1000 */
-   if (16 == ppu.obj_height)
-      vram_adr = ((tile_index & 1) << 12) | ((tile_index & 0xFE) << 4);
-   else
-      vram_adr = ppu.obj_base + (tile_index << 4);
-
-   data_ptr = &PPU_MEM(vram_adr);
-
-   /* Calculate offset (line within the sprite) */
-   y_offset = scanline - sprite_y;
-   if (y_offset > 7)
-      y_offset += 8;
-
-   /* Account for vertical flippage */
-   if (attrib & OAMF_VFLIP)
-   {
-      if (16 == ppu.obj_height)
-         y_offset -= 23;
-      else
-         y_offset -= 7;
-      data_ptr -= y_offset;
-   }
-   else
-   {
-      data_ptr += y_offset;
-   }
-
    /* check for a solid sprite 0 pixel */
-   pat1 = data_ptr[0];
-   pat2 = data_ptr[8];
-   color = ((pat2 & 0xAA) << 8) | ((pat2 & 0x55) << 1)
-                  | ((pat1 & 0xAA) << 7) | (pat1 & 0x55);
+   color = chr_row(oam_rowaddr(sprite_ptr, slot));
 
    if (color)
    {
@@ -1071,8 +1253,10 @@ void ppu_checknmi(void)
       nes_nmi();
 }
 
-void ppu_scanline(bitmap_t *bmp, int scanline, bool draw_flag)
+void ppu_scanline(bitmap_t *bmp, int scanline, bool draw_flag, uint32 start_cycle)
 {
+   line_cycle = start_cycle;
+
    if (scanline < 240)
    {
       /* Lower the Max Sprite per scanline flag */
@@ -1137,7 +1321,7 @@ static void draw_sprite(bitmap_t *bmp, int x, int y, uint8 tile_num, uint8 attri
       if (line == 8)
          data_ptr += 8;
 
-      draw_bgtile(vid, data_ptr[0], data_ptr[8], ppu.palette + 16 + col_high);
+      draw_bgrow(vid, chr_interleave(data_ptr[0], data_ptr[8]), ppu.palette + 16 + col_high);
       //draw_oamtile(vid, attrib, data_ptr[0], data_ptr[8], ppu.palette + 16 + col_high);
 
       data_ptr++;
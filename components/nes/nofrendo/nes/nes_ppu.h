@@ -128,16 +128,20 @@ extern void ppu_mirrorhipages(void);
 extern void ppu_mirror(int nt1, int nt2, int nt3, int nt4);
 
 extern void ppu_setpage(int size, int page_num, uint8 *location);
+extern void ppu_setchrmem(uint8 *vrom, int vrom_size, uint8 *vram, int vram_size);
+extern void ppu_refreshchr(void);
 extern uint8 *ppu_getpage(int page);
 
 
 /* control */
 extern void ppu_reset(int reset_type);
 extern bool ppu_enabled(void);
-extern void ppu_scanline(bitmap_t *bmp, int scanline, bool draw_flag);
+extern void ppu_scanline(bitmap_t *bmp, int scanline, bool draw_flag, uint32 start_cycle);
 extern void ppu_endscanline(int scanline);
 extern void ppu_checknmi();
 
+extern void ppu_print_stats(void);
+
 extern ppu_t *ppu_create(void);
 extern void ppu_destroy(ppu_t **ppu);
 
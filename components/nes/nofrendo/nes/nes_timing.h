@@ -0,0 +1,44 @@
+/*
+** Nofrendo (c) 1998-2000 Matthew Conte (matt@conte.com)
+**
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of version 2 of the GNU Library General
+** Public License as published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+** Library General Public License for more details.  To obtain a
+** copy of the GNU Library General Public License, write to the Free
+** Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+**
+** Any permitted reproduction of these routines, in whole or in part,
+** must bear this legend.
+**
+**
+** nes_timing.h
+**
+** NES frame timing, kept apart from nes.c so the host tests can use it
+*/
+
+#ifndef _NES_TIMING_H_
+#define _NES_TIMING_H_
+
+/* frame timing is kept in PPU dots, 3 to a CPU cycle, so it stays exact */
+#define  NES_CPU_DOTS         3
+#define  NES_SCANLINE_DOTS    341
+#define  NES_FRAME_LINES      262
+#define  NES_FRAME_DOTS       (NES_FRAME_LINES * NES_SCANLINE_DOTS)
+
+/* cycle of the frame at which a scanline starts, frame_dots being the
+** PPU dots owed to (or overrun into) the frame
+*/
+#define  NES_LINE_CYCLE(line, frame_dots) \
+   (((line) * NES_SCANLINE_DOTS + (frame_dots)) / NES_CPU_DOTS)
+
+/* the dots owed to the next frame, after this one ran frame_cycles */
+#define  NES_CARRY_DOTS(frame_dots, frame_cycles) \
+   ((frame_dots) + NES_FRAME_DOTS - (frame_cycles) * NES_CPU_DOTS)
+
+#endif /* !_NES_TIMING_H_ */
@@ -56,7 +56,6 @@ void state_setslot(int slot)
 
 int save_baseblock(nes_t *state, SNSS_FILE *snssFile)
 {
-    printf("save_baseblock\n");
    int i;
 
    ASSERT(state);
@@ -97,12 +96,10 @@ int save_baseblock(nes_t *state, SNSS_FILE *snssFile)
 
 bool save_vramblock(nes_t *state, SNSS_FILE *snssFile)
 {
-    printf("save_vramblock\n");
    ASSERT(state);
 
    if (NULL == state->rominfo->vram)
    {
-       printf("save_vramblock: NULL == state->rominfo->vram\n");
        return -1;
   }
 
@@ -120,7 +117,6 @@ bool save_vramblock(nes_t *state, SNSS_FILE *snssFile)
 
 int save_sramblock(nes_t *state, SNSS_FILE *snssFile)
 {
-    printf("save_sramblock\n");
    int i;
    bool written = false;
    int sram_length;
@@ -141,7 +137,6 @@ int save_sramblock(nes_t *state, SNSS_FILE *snssFile)
 
    if (false == written)
    {
-       printf("save_srambloc: false == written\n");
       return -1;
   }
 
@@ -163,7 +158,6 @@ int save_sramblock(nes_t *state, SNSS_FILE *snssFile)
 
 int save_soundblock(nes_t *state, SNSS_FILE *snssFile)
 {
-    printf("save_soundblock\n");
    ASSERT(state);
 
    apu_getcontext(state->apu);
@@ -199,7 +193,6 @@ int save_soundblock(nes_t *state, SNSS_FILE *snssFile)
 
 int save_mapperblock(nes_t *state, SNSS_FILE *snssFile)
 {
-    printf("save_mapperblock\n");
    int i;
    ASSERT(state);
 
@@ -209,7 +202,6 @@ int save_mapperblock(nes_t *state, SNSS_FILE *snssFile)
    /* We don't need to write mapper state for mapper 0 */
    if (0 == state->mmc->intf->number)
    {
-       printf("save_mapperblock: 0 == state->mmc->intf->number\n");
        return -1;
     }
 
@@ -239,7 +231,6 @@ int save_mapperblock(nes_t *state, SNSS_FILE *snssFile)
 
 void load_baseblock(nes_t *state, SNSS_FILE *snssFile)
 {
-    printf("load_baseblock\n");
 
    int i;
 
@@ -291,17 +282,16 @@ void load_baseblock(nes_t *state, SNSS_FILE *snssFile)
 
 void load_vramblock(nes_t *state, SNSS_FILE *snssFile)
 {
-    printf("load_vramblock\n");
 
    ASSERT(state);
 
    ASSERT(snssFile->vramBlock.vramSize <= VRAM_8K); /* can't handle more than this! */
    memcpy(state->rominfo->vram, snssFile->vramBlock.vram, snssFile->vramBlock.vramSize);
+   ppu_refreshchr();
 }
 
 void load_sramblock(nes_t *state, SNSS_FILE *snssFile)
 {
-    printf("load_sramblock\n");
 
    ASSERT(state);
 
@@ -311,7 +301,6 @@ void load_sramblock(nes_t *state, SNSS_FILE *snssFile)
 
 void load_controllerblock(nes_t *state, SNSS_FILE *snssFile)
 {
-    printf("load_controllerblock\n");
 
    UNUSED(state);
    UNUSED(snssFile);
@@ -319,7 +308,6 @@ void load_controllerblock(nes_t *state, SNSS_FILE *snssFile)
 
 void load_soundblock(nes_t *state, SNSS_FILE *snssFile)
 {
-    printf("load_soundblock\n");
 
    int i;
 
@@ -336,7 +324,6 @@ void load_soundblock(nes_t *state, SNSS_FILE *snssFile)
 /* TODO: magic numbers galore */
 void load_mapperblock(nes_t *state, SNSS_FILE *snssFile)
 {
-    printf("load_mapperblock\n");
 
    int i;
 
@@ -367,123 +354,65 @@ void load_mapperblock(nes_t *state, SNSS_FILE *snssFile)
 }
 
 
-static int state_save(char* fn, nes_t *machine)
+/* write every block of the machine state to an open snss file */
+static SNSS_RETURN_CODE state_write_blocks(SNSS_FILE *snssFile, nes_t *machine)
 {
-   SNSS_FILE *snssFile;
-   SNSS_RETURN_CODE status;
-
-   // nes_t *machine;
+   SNSS_RETURN_CODE status = SNSS_OK;
 
-   /* get the pointer to our NES machine context */
-   // machine = console_nes;
-   ASSERT(machine);
-
-   printf("state_save: fn='%s'\n", fn);
-
-   /* open our state file for writing */
-   status = SNSS_OpenFile(&snssFile, fn, SNSS_OPEN_WRITE);
-   if (SNSS_OK != status)
-      goto _error;
-
-   printf("state_save: SNSS_OpenFile OK\n");
-
-   /* now get all of our blocks */
    if (0 == save_baseblock(machine, snssFile))
    {
       status = SNSS_WriteBlock(snssFile, SNSS_BASR);
       if (SNSS_OK != status)
-         goto _error;
+         return status;
    }
-   printf("state_save: save_baseblock OK\n");
 
    if (0 == save_vramblock(machine, snssFile))
    {
       status = SNSS_WriteBlock(snssFile, SNSS_VRAM);
       if (SNSS_OK != status)
-         goto _error;
+         return status;
    }
-   printf("state_save: save_vramblock OK\n");
 
    if (0 == save_sramblock(machine, snssFile))
    {
       status = SNSS_WriteBlock(snssFile, SNSS_SRAM);
       if (SNSS_OK != status)
-         goto _error;
+         return status;
    }
-   printf("state_save: save_sramblock OK\n");
 
    if (0 == save_soundblock(machine, snssFile))
    {
       status = SNSS_WriteBlock(snssFile, SNSS_SOUN);
       if (SNSS_OK != status)
-         goto _error;
+         return status;
    }
-   printf("state_save: save_soundblock OK\n");
 
    if (0 == save_mapperblock(machine, snssFile))
    {
       status = SNSS_WriteBlock(snssFile, SNSS_MPRD);
       if (SNSS_OK != status)
-         goto _error;
+         return status;
    }
-   printf("state_save: save_mapperblock OK\n");
 
-   /* close the file, we're done */
-   status = SNSS_CloseFile(&snssFile);
-   if (SNSS_OK != status)
-      goto _error;
-
-   printf("State %d saved\n", state_slot);
-   return 0;
-
-_error:
-   printf("error: %s\n", SNSS_GetErrorString(status));
-   SNSS_CloseFile(&snssFile);
-   abort();
+   return status;
 }
 
-
-extern bool forceConsoleReset;
-
-static int state_load(char* fn, nes_t* machine)
+/* read every block present in an open snss file into the machine */
+static SNSS_RETURN_CODE state_read_blocks(SNSS_FILE *snssFile, nes_t *machine)
 {
-   SNSS_FILE *snssFile;
    SNSS_RETURN_CODE status;
    SNSS_BLOCK_TYPE block_type;
-
    unsigned int i;
-   // nes_t *machine;
-   nes_t nes;
-
-   /* get our machine's context pointer */
-   // machine = console_nes;
-
-   ASSERT(machine);
-
-   printf("state_load: fn='%s'\n", fn);
-
-   /* open our file for reading */
-   status = SNSS_OpenFile(&snssFile, fn, SNSS_OPEN_READ);
-   if (SNSS_OK != status)
-   {
-       printf("state_load: file '%s' could not be opened.\n", fn);
-       forceConsoleReset = true;
-       return 0; //goto _error;
-  }
-
-
-   /* iterate through all present blocks */
-   printf("state_load: snssFile->headerBlock.numberOfBlocks=%d\n", snssFile->headerBlock.numberOfBlocks);
 
    for (i = 0; i < snssFile->headerBlock.numberOfBlocks; i++)
    {
       status = SNSS_GetNextBlockType(&block_type, snssFile);
       if (SNSS_OK != status)
-         goto _error;
+         return status;
 
       status = SNSS_ReadBlock(snssFile, block_type);
       if (SNSS_OK != status)
-         goto _error;
+         return status;
 
       switch (block_type)
       {
@@ -518,6 +447,81 @@ static int state_load(char* fn, nes_t* machine)
       }
    }
 
+   return SNSS_OK;
+}
+
+static int state_save(char* fn, nes_t *machine)
+{
+   SNSS_FILE *snssFile;
+   SNSS_RETURN_CODE status;
+
+   // nes_t *machine;
+
+   /* get the pointer to our NES machine context */
+   // machine = console_nes;
+   ASSERT(machine);
+
+   printf("state_save: fn='%s'\n", fn);
+
+   /* open our state file for writing */
+   status = SNSS_OpenFile(&snssFile, fn, SNSS_OPEN_WRITE);
+   if (SNSS_OK != status)
+      goto _error;
+
+   printf("state_save: SNSS_OpenFile OK\n");
+
+   /* now get all of our blocks */
+   status = state_write_blocks(snssFile, machine);
+   if (SNSS_OK != status)
+      goto _error;
+   printf("state_save: blocks OK\n");
+
+   /* close the file, we're done */
+   status = SNSS_CloseFile(&snssFile);
+   if (SNSS_OK != status)
+      goto _error;
+
+   printf("State %d saved\n", state_slot);
+   return 0;
+
+_error:
+   printf("error: %s\n", SNSS_GetErrorString(status));
+   SNSS_CloseFile(&snssFile);
+   abort();
+}
+
+
+extern bool forceConsoleReset;
+
+static int state_load(char* fn, nes_t* machine)
+{
+   SNSS_FILE *snssFile;
+   SNSS_RETURN_CODE status;
+
+   /* get our machine's context pointer */
+   // machine = console_nes;
+
+   ASSERT(machine);
+
+   printf("state_load: fn='%s'\n", fn);
+
+   /* open our file for reading */
+   status = SNSS_OpenFile(&snssFile, fn, SNSS_OPEN_READ);
+   if (SNSS_OK != status)
+   {
+       printf("state_load: file '%s' could not be opened.\n", fn);
+       forceConsoleReset = true;
+       return 0; //goto _error;
+  }
+
+
+   /* iterate through all present blocks */
+   printf("state_load: snssFile->headerBlock.numberOfBlocks=%d\n", snssFile->headerBlock.numberOfBlocks);
+
+   status = state_read_blocks(snssFile, machine);
+   if (SNSS_OK != status)
+      goto _error;
+
    /* close file, we're done */
    status = SNSS_CloseFile(&snssFile);
 
@@ -530,6 +534,55 @@ _error:
    abort();
 }
 
+/* snapshot the machine into a memory buffer, returns the number of bytes
+** used or 0 if it did not fit. Used by rewind, so it is quiet and never
+** aborts.
+*/
+size_t state_save_mem(uint8 *buffer, size_t capacity, nes_t *machine)
+{
+   SNSS_FILE *snssFile;
+   SNSS_RETURN_CODE status;
+   FILE *fp;
+   long size;
+
+   fp = fmemopen(buffer, capacity, "wb");
+   if (NULL == fp)
+      return 0;
+
+   status = SNSS_OpenStream(&snssFile, fp, SNSS_OPEN_WRITE);
+   if (SNSS_OK != status)
+   {
+      SNSS_CloseFile(&snssFile);
+      return 0;
+   }
+
+   status = state_write_blocks(snssFile, machine);
+   size = ftell(fp);
+   if (SNSS_OK != SNSS_CloseFile(&snssFile) || SNSS_OK != status || size <= 0)
+      return 0;
+
+   return (size_t) size;
+}
+
+/* restore a snapshot taken with state_save_mem, returns 0 on success */
+int state_load_mem(const uint8 *buffer, size_t size, nes_t *machine)
+{
+   SNSS_FILE *snssFile;
+   SNSS_RETURN_CODE status;
+   FILE *fp;
+
+   fp = fmemopen((void *) buffer, size, "rb");
+   if (NULL == fp)
+      return -1;
+
+   status = SNSS_OpenStream(&snssFile, fp, SNSS_OPEN_READ);
+   if (SNSS_OK == status)
+      status = state_read_blocks(snssFile, machine);
+
+   SNSS_CloseFile(&snssFile);
+   return (SNSS_OK == status) ? 0 : -1;
+}
+
 
 void save_sram(char* filename, nes_t *machine)
 {
@@ -35,6 +35,9 @@ extern void state_setslot(int slot);
 void save_sram(char* filename, nes_t *machine);
 void load_sram(char* filename, nes_t *machine);
 
+size_t state_save_mem(uint8 *buffer, size_t capacity, nes_t *machine);
+int state_load_mem(const uint8 *buffer, size_t size, nes_t *machine);
+
 #endif /* _NESSTATE_H_ */
 
 /*
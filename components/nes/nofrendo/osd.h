@@ -57,6 +57,7 @@ extern void osd_setsound(void (*playfunc)(void *buffer, int size));
 
 
 #ifndef NSF_PLAYER
+#include <stdint.h>
 #include <noftypes.h>
 #include <vid_drv.h>
 
@@ -74,7 +75,13 @@ typedef struct sndinfo_s
 
 
 extern void osd_set_video_scale(bool new_video_scale);
+/* the 256 entry palette the PPU hands the video driver, in panel colors */
+extern void nes_build_palette(const rgb_t *pal);
 extern uint16_t* get_nes_palette();
+/* first visible line of the last complete frame, pitch is set to its pitch */
+extern const uint8_t* get_nes_last_frame(int *pitch);
+/* bitmap over the frame exchange's back buffer, the next frame renders here */
+extern bitmap_t *osd_frame_bitmap(void);
 /* get info */
 extern void osd_getvideoinfo(vidinfo_t *info);
 extern void osd_getsoundinfo(sndinfo_t *info);
@@ -71,7 +71,7 @@ typedef struct mmc5rectangle_s
 
    bool enabled;
    
-   float accum;
+   int32 accum;
    int32 freq;
    int32 output_vol;
    bool fixed_envelope;
@@ -96,7 +96,7 @@ typedef struct mmc5dac_s
 
 static struct
 {
-   float incsize;
+   int32 incsize;
    uint8 mul[2];
    mmc5rectangle_t rect[2];
    mmc5dac_t dac;
@@ -158,7 +158,7 @@ static int32 mmc5_rectangle(mmc5rectangle_t *chan)
 
    while (chan->accum < 0)
    {
-      chan->accum += chan->freq;
+      chan->accum += APU_FIXED(chan->freq);
       chan->adder = (chan->adder + 1) & 0x0F;
 
 #ifdef APU_OVERSAMPLE
@@ -246,7 +246,7 @@ static int32 apu_rectangle_##ch(void) \
 \
    while (apu.rectangle[ch].accum < 0) \
    { \
-      apu.rectangle[ch].accum += apu.rectangle[ch].freq + 1; \
+      apu.rectangle[ch].accum += APU_FIXED(apu.rectangle[ch].freq + 1); \
       apu.rectangle[ch].adder = (apu.rectangle[ch].adder + 1) & 0x0F; \
 \
       if (apu.rectangle[ch].adder < apu.rectangle[ch].duty_flip) \
@@ -320,7 +320,7 @@ static int32 apu_rectangle_##ch(void) \
 \
    while (apu.rectangle[ch].accum < 0) \
    { \
-      apu.rectangle[ch].accum += (apu.rectangle[ch].freq + 1); \
+      apu.rectangle[ch].accum += APU_FIXED(apu.rectangle[ch].freq + 1); \
       apu.rectangle[ch].adder = (apu.rectangle[ch].adder + 1) & 0x0F; \
    } \
 \
@@ -376,7 +376,7 @@ static int32 apu_triangle(void)
    apu.triangle.accum -= apu.cycle_rate; \
    while (apu.triangle.accum < 0)
    {
-      apu.triangle.accum += apu.triangle.freq;
+      apu.triangle.accum += APU_FIXED(apu.triangle.freq);
       apu.triangle.adder = (apu.triangle.adder + 1) & 0x1F;
 
       if (apu.triangle.adder & 0x10)
@@ -445,7 +445,7 @@ static int32 apu_noise(void)
 
    while (apu.noise.accum < 0)
    {
-      apu.noise.accum += apu.noise.freq;
+      apu.noise.accum += APU_FIXED(apu.noise.freq);
 
 #ifdef REALTIME_NOISE
 
@@ -542,7 +542,7 @@ static int32 apu_dmc(void)
       
       while (apu.dmc.accum < 0)
       {
-         apu.dmc.accum += apu.dmc.freq;
+         apu.dmc.accum += APU_FIXED(apu.dmc.freq);
          
          delta_bit = (apu.dmc.dma_length & 7) ^ 7;
          
@@ -684,7 +684,7 @@ void apu_write(uint32 address, uint8 value)
       ** for the 6502 code to do a couple of table dereferences and load up 
       ** the other triregs
       */
-      apu.triangle.write_latency = (int) (228 / apu.cycle_rate);
+      apu.triangle.write_latency = APU_FIXED(228) / apu.cycle_rate;
       apu.triangle.freq = (((value & 7) << 8) + apu.triangle.regs[1]) + 1;
       apu.triangle.vbl_length = vbl_lut[value >> 3];
       apu.triangle.counter_started = false;
@@ -985,7 +985,7 @@ void apu_setparams(double base_freq, int sample_rate, int refresh_rate, int samp
       apu.base_freq = APU_BASEFREQ;
    else
       apu.base_freq = base_freq;
-   apu.cycle_rate = (float) (apu.base_freq / sample_rate);
+   apu.cycle_rate = (int32) (APU_FIXED(1) * apu.base_freq / sample_rate + 0.5);
 
    /* build various lookup tables for apu */
    apu_build_luts(apu.num_samples);
@@ -58,6 +58,12 @@
 #define  APU_BASEFREQ   1789772.7272727272727272
 
 
+/* Channel accumulators count CPU cycles in 16.16 fixed point, which
+** keeps the per-sample stepping off the FPU
+*/
+#define  APU_FIXED_SHIFT      16
+#define  APU_FIXED(x)         ((int32) (x) << APU_FIXED_SHIFT)
+
 /* channel structures */
 /* As much data as possible is precalculated,
 ** to keep the sample processing as lean as possible
@@ -69,7 +75,7 @@ typedef struct rectangle_s
 
    bool enabled;
    
-   float accum;
+   int32 accum;
    int32 freq;
    int32 output_vol;
    bool fixed_envelope;
@@ -100,7 +106,7 @@ typedef struct triangle_s
 
    bool enabled;
 
-   float accum;
+   int32 accum;
    int32 freq;
    int32 output_vol;
 
@@ -122,7 +128,7 @@ typedef struct noise_s
 
    bool enabled;
 
-   float accum;
+   int32 accum;
    int32 freq;
    int32 output_vol;
 
@@ -151,7 +157,7 @@ typedef struct dmc_s
    /* bodge for timestamp queue */
    bool enabled;
    
-   float accum;
+   int32 accum;
    int32 freq;
    int32 output_vol;
 
@@ -213,7 +219,7 @@ typedef struct apu_s
    int filter_type;
 
    double base_freq;
-   float cycle_rate;
+   int32 cycle_rate; /* CPU cycles per sample, APU_FIXED */
 
    int sample_rate;
    int sample_bits;
@@ -33,7 +33,7 @@ typedef struct vrcvirectangle_s
 
    uint8 reg[3];
    
-   float accum;
+   int32 accum;
    uint8 adder;
 
    int32 freq;
@@ -47,7 +47,7 @@ typedef struct vrcvisawtooth_s
    
    uint8 reg[3];
    
-   float accum;
+   int32 accum;
    uint8 adder;
    uint8 output_acc;
 
@@ -59,7 +59,7 @@ typedef struct vrcvisnd_s
 {
    vrcvirectangle_t rectangle[2];
    vrcvisawtooth_t saw;
-   float incsize;
+   int32 incsize;
 } vrcvisnd_t;
 
 
@@ -76,7 +76,7 @@ static int32 vrcvi_rectangle(vrcvirectangle_t *chan)
    chan->accum -= vrcvi.incsize; /* # of clocks per wave cycle */
    while (chan->accum < 0)
    {
-      chan->accum += chan->freq;
+      chan->accum += APU_FIXED(chan->freq);
       chan->adder = (chan->adder + 1) & 0x0F;
    }
 
@@ -101,7 +101,7 @@ static int32 vrcvi_sawtooth(vrcvisawtooth_t *chan)
    chan->accum -= vrcvi.incsize; /* # of clocks per wav cycle */
    while (chan->accum < 0)
    {
-      chan->accum += chan->freq;
+      chan->accum += APU_FIXED(chan->freq);
       chan->output_acc += chan->volume;
       
       chan->adder++;
@@ -14,6 +14,8 @@ static nes_t* console_nes;
 #include "fs_init.h"
 #include "format.hpp"
 #include "i80_lcd.h"
+#include "frame_policy.h"
+#include "rewind.h"
 
 static bool scaled = false;
 static bool filled = true;
@@ -38,6 +40,18 @@ void set_nes_video_fill() {
 
 void reset_nes() {
   nes_reset(SOFT_RESET);
+  rewind_reset();
+}
+
+// base, vram, sram, sound and mapper blocks come to ~25KB
+static constexpr size_t NES_STATE_CAPACITY = 48 * 1024;
+
+static size_t save_nes_state(uint8_t *buffer, size_t capacity) {
+  return state_save_mem(buffer, capacity, console_nes);
+}
+
+static bool load_nes_state(const uint8_t *buffer, size_t size) {
+  return state_load_mem(buffer, size, console_nes) == 0;
 }
 
 static uint8_t first_frame = 0;
@@ -58,21 +72,25 @@ void init_nes(const std::string& rom_filename, uint8_t *romdata, size_t rom_data
   nes_insertcart(rom_filename.c_str(), console_nes);
   vid_setmode(NES_SCREEN_WIDTH, NES_VISIBLE_HEIGHT);
   nes_prep_emulation(nullptr, console_nes);
+  frame_policy_reset();
+  rewind_init(NES_STATE_CAPACITY, save_nes_state, load_nes_state);
   first_frame = 1;
 }
 
 void run_nes_rom() {
   auto start = std::chrono::high_resolution_clock::now();
-  nes_emulateframe(first_frame);
-  first_frame = 0;
-  // frame rate should be 60 FPS, so 1/60th second is what we want to sleep for
-  // note: 1/60 negatively affects sound, try 1/128
-  auto delay = std::chrono::duration<float>(1.0f/128.0f);
+  // while rewind is held only the frames it restores are run
+  if (rewind_update()) {
+    nes_emulateframe(first_frame);
+    first_frame = 0;
+  }
+  auto delay = std::chrono::microseconds(frame_policy_frame_period_us());
   std::this_thread::sleep_until(start + delay);
 }
 
 void load_nes(std::string_view save_path) {
   nes_prep_emulation((char *)save_path.data(), console_nes);
+  rewind_reset();
 }
 
 void save_nes(std::string_view save_path) {
@@ -81,12 +99,13 @@ void save_nes(std::string_view save_path) {
 
 std::vector<uint8_t> get_nes_video_buffer() {
   std::vector<uint8_t> frame(NES_SCREEN_WIDTH * NES_VISIBLE_HEIGHT * 2);
-  // the frame data for the NES is stored in frame_buffer0 as a 8 bit index into the palette
+  // the last frame for the NES is stored as a 8 bit index into the palette
   // we need to convert this to a 16 bit RGB565 value
-  uint8_t *frame_buffer0 = get_frame_buffer0();
+  int pitch = 0;
+  const uint8_t *last_frame = get_nes_last_frame(&pitch);
   uint16_t *palette = get_nes_palette();
   for (int i = 0; i < NES_SCREEN_WIDTH * NES_VISIBLE_HEIGHT; i++) {
-    uint8_t index = frame_buffer0[i];
+    uint8_t index = last_frame[(i / NES_SCREEN_WIDTH) * pitch + i % NES_SCREEN_WIDTH];
     uint16_t color = palette[index];
     frame[i * 2] = color & 0xFF;
     frame[i * 2 + 1] = color >> 8;
@@ -105,5 +124,6 @@ void start_nes_tasks() {
 }
 
 void deinit_nes() {
+  rewind_deinit();
   nes_poweroff();
 }
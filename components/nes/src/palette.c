@@ -0,0 +1,28 @@
+/*
+** palette.c
+**
+** The NES palette as the panel takes it, looked up by the display pipeline
+** for every pixel of a frame
+*/
+
+#include <noftypes.h>
+#include <bitmap.h>
+#include <osd.h>
+
+// from box-emu-hal
+#include "i80_lcd.h"
+
+static uint16 myPalette[256];
+
+/* copy nes palette over to hardware */
+void nes_build_palette(const rgb_t *pal)
+{
+   int i;
+
+   for (i = 0; i < 256; i++)
+      myPalette[i] = make_color(pal[i].r, pal[i].g, pal[i].b);
+}
+
+uint16_t* get_nes_palette() {
+    return (uint16_t*)myPalette;
+}
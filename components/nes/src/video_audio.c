@@ -16,6 +16,7 @@
 #include <freertos/timers.h>
 #include <freertos/task.h>
 #include <freertos/queue.h>
+#include <esp_timer.h>
 
 //Nes stuff wants to define this as well...
 #undef false
@@ -41,6 +42,12 @@
 #include "i80_lcd.h"
 #include "i2s_audio.h"
 #include "badge_input.h"
+#include "display_pipeline.h"
+#include "frame_exchange.h"
+#include "frame_policy.h"
+#include "overlay.h"
+#include "rewind.h"
+#include "scaler.h"
 
 #define  DEFAULT_FRAGSIZE    AUDIO_BUFFER_SIZE
 
@@ -70,7 +77,11 @@ void do_audio_frame() {
 
         //get more data
         audio_callback(audio_frame, n);
-        audio_play_frame(audio_frame, 2*n);
+        // in turbo the apu still runs (its length counters are visible to
+        // the game) but the blocking I2S write would hold us to real time,
+        // and going back through rewind snapshots stays quiet
+        if (frame_policy_should_play_audio() && !rewind_is_active())
+            audio_play_frame(audio_frame, 2*n);
 
         remaining -= n;
     }
@@ -122,8 +133,6 @@ static bitmap_t *lock_write(void);
 static void free_write(int num_dirties, rect_t *dirty_rects);
 static void custom_blit(bitmap_t *bmp, int num_dirties, rect_t *dirty_rects);
 
-QueueHandle_t vidQueue;
-
 viddriver_t sdlDriver =
 {
    "Simple DirectMedia Layer",         /* name */
@@ -143,71 +152,59 @@ viddriver_t sdlDriver =
 #define NES_GAME_HEIGHT (224) /* NES_VISIBLE_HEIGHT */
 
 static bool special_func_ready = true;
-static bool scale_video = false;
-static bool prev_scale_video = false;
+// 256 wide to 320 for FILL, built when the mode is picked
+static struct Scaler fill_scaler;
 void osd_set_video_scale(bool new_video_scale) {
-    scale_video = new_video_scale;
+    if (new_video_scale) {
+        scaler_init(&fill_scaler, NES_GAME_WIDTH, NES_GAME_HEIGHT, 320, NES_GAME_HEIGHT, SCALER_DEFAULT_FILTER);
+        display_pipeline_set_scaler(&fill_scaler);
+    } else {
+        display_pipeline_set_scaler(NULL);
+    }
 }
 
-void ili9341_write_frame_nes(const uint8_t* buffer, uint16_t* myPalette) {
-    short x, y;
-    int x_offset = (320-256)/2;
-    int y_offset = (240-224)/2;
-    if (buffer == NULL) {
-        // clear the buffer, clear the screen
-        lcd_write_frame(0+x_offset, 0+y_offset, NES_GAME_WIDTH-1, NES_GAME_HEIGHT-1, NULL);
-    } else {
-        if (prev_scale_video != scale_video) {
-            // update our local
-            prev_scale_video = scale_video;
-            // clear the frame
-            lcd_write_frame(0,0,320,240,NULL);
-        }
-        if (scale_video) {
-            uint8_t* framePtr = buffer;
-            static int buffer_index = 0;
-            static const int LINE_COUNT = NUM_ROWS_IN_FRAME_BUFFER;
-            float x_scale = 1.25f;
-            float y_scale = 1.0f;
-            for (y = 0; y < 240; y+= LINE_COUNT) {
-                uint16_t* line_buffer = buffer_index ? (uint16_t*)get_vram1() : (uint16_t*)get_vram0();
-                buffer_index = buffer_index ? 0 : 1;
-                int num_lines_written = 0;
-                for (int i=0; i<LINE_COUNT; i++) {
-                    int src_y = (float)(y+i) / y_scale;
-                    if (src_y >= NES_GAME_HEIGHT) break;
-                    for (x=0; x<320; ++x) {
-                        int src_x = (float)(x) / x_scale;
-                        int src_index = (src_y)*NES_GAME_WIDTH + src_x;
-                        int dst_index = i*320 + x;
-                        line_buffer[dst_index] = (uint16_t)myPalette[framePtr[src_index]];
-                    }
-                    num_lines_written++;
-                }
-                lcd_write_frame(0, y_offset+y, 320, num_lines_written, (uint8_t*)&line_buffer[0]);
-            }
-        } else {
-            uint8_t* framePtr = buffer;
-            static int buffer_index = 0;
-            static const int LINE_COUNT = NUM_ROWS_IN_FRAME_BUFFER;
-            for (y = 0; y < NES_GAME_HEIGHT; y+= LINE_COUNT) {
-                uint16_t* line_buffer = buffer_index ? (uint16_t*)get_vram1() : (uint16_t*)get_vram0();
-                buffer_index = buffer_index ? 0 : 1;
-                int num_lines_written = 0;
-                for (int i=0; i<LINE_COUNT; i++) {
-                    int src_y = y+i;
-                    if (src_y >= NES_GAME_HEIGHT) break;
-                    for (x=0; x<NES_GAME_WIDTH; ++x) {
-                        int src_index = (src_y)*NES_GAME_WIDTH + x;
-                        int dst_index = i*NES_GAME_WIDTH + x;
-                        line_buffer[dst_index] = (uint16_t)myPalette[framePtr[src_index]];
-                    }
-                    num_lines_written++;
-                }
-                lcd_write_frame(x_offset, y_offset+y, NES_GAME_WIDTH, num_lines_written, (uint8_t*)&line_buffer[0]);
-            }
-        }
+// first line of the nes bitmap that makes it to the screen
+#define NES_GAME_TOP ((NES_SCREEN_HEIGHT - NES_GAME_HEIGHT) / 2)
+// nofrendo draws with 8 pixels of overdraw on each side
+#define NES_FRAME_PITCH (NES_SCREEN_WIDTH + 2 * 8)
+// room for one full bitmap (NES_FRAME_PITCH * NES_SCREEN_HEIGHT), two fit in
+// each lcd frame buffer
+#define NES_FRAME_SLOT (64 * 1024)
+
+// the emulator renders straight into these, they take turns going through the
+// frame exchange. They take both slots of frame_buffer0 and the second one of
+// frame_buffer1, the first one of frame_buffer1 is the video driver's screen
+// bitmap (see lock_write).
+static bitmap_t *frame_bitmaps[3];
+
+static void init_frame_bitmaps() {
+    uint8_t *buffers[3] = {
+        get_frame_buffer0(),
+        get_frame_buffer0() + NES_FRAME_SLOT,
+        get_frame_buffer1() + NES_FRAME_SLOT,
+    };
+    for (int i=0; i<3; i++) {
+        frame_bitmaps[i] = bmp_createhw(buffers[i] + 8, NES_SCREEN_WIDTH, NES_SCREEN_HEIGHT, NES_FRAME_PITCH);
+        bmp_clear(frame_bitmaps[i], 0);
+    }
+    frame_exchange_init(frame_bitmaps[0]->line[NES_GAME_TOP],
+                        frame_bitmaps[1]->line[NES_GAME_TOP],
+                        frame_bitmaps[2]->line[NES_GAME_TOP],
+                        NES_GAME_HEIGHT);
+}
+
+bitmap_t *osd_frame_bitmap(void) {
+    uint8_t *back = frame_exchange_back();
+    for (int i=0; i<3; i++) {
+        if (frame_bitmaps[i]->line[NES_GAME_TOP] == back)
+            return frame_bitmaps[i];
     }
+    return frame_bitmaps[0];
+}
+
+const uint8_t *get_nes_last_frame(int *pitch) {
+    *pitch = NES_FRAME_PITCH;
+    return frame_exchange_latest();
 }
 
 bitmap_t *myBitmap;
@@ -240,26 +237,11 @@ static int set_mode(int width, int height)
    return 0;
 }
 
-uint16 myPalette[256];
-
 /* copy nes palette over to hardware */
 static void set_palette(rgb_t *pal)
 {
-	uint16 c;
-
-   int i;
-
    printf("set palette!\n");
-   for (i = 0; i < 256; i++)
-   {
-      c = make_color(pal[i].r, pal[i].g, pal[i].b);
-      myPalette[i]= c;
-   }
-
-}
-
-uint16_t* get_nes_palette() {
-    return (uint16_t*)myPalette;
+   nes_build_palette(pal);
 }
 
 /* clear all frames to a particular color */
@@ -267,11 +249,19 @@ static void clear(uint8 color)
 {
 }
 
+// The screen bitmap, in the first slot of frame_buffer1. nofrendo only draws
+// to it from vid_blitscreen(), which custom_blit replaces, but it has to stay
+// clear of the frame bitmaps in case that ever changes.
+#if DEFAULT_WIDTH * DEFAULT_HEIGHT > NES_FRAME_SLOT
+#error "the screen bitmap runs into the frame bitmap after it"
+#endif
+
 /* acquire the directbuffer for writing */
 static bitmap_t *lock_write(void)
 {
 //   SDL_LockSurface(mySurface);
-   myBitmap = bmp_createhw((uint8*)get_frame_buffer1(), DEFAULT_WIDTH, DEFAULT_HEIGHT, DEFAULT_WIDTH*2);
+   // 8 bit palette indices, one byte per pixel
+   myBitmap = bmp_createhw((uint8*)get_frame_buffer1(), DEFAULT_WIDTH, DEFAULT_HEIGHT, DEFAULT_WIDTH);
    // make sure they don't try to delete the frame buffer lol
    myBitmap->hardware = true;
    return myBitmap;
@@ -284,52 +274,16 @@ static void free_write(int num_dirties, rect_t *dirty_rects)
 }
 
 static void custom_blit(bitmap_t *bmp, int num_dirties, rect_t *dirty_rects) {
-    uint8_t *lcdfb = get_frame_buffer0();
-    if (bmp->line[0] != NULL)
-    {
-        memcpy(lcdfb, bmp->line[0], 256 * 224);
-
-        void* arg = (void*)lcdfb;
-    	xQueueSend(vidQueue, &arg, portMAX_DELAY);
-    }
-}
-
-
-
-//This runs on core 1.
-volatile bool video_task_paused = false;
-volatile bool exitVideoTaskFlag = false;
-static void videoTask(void *arg) {
-    uint8_t* bmp = NULL;
-
-    while(1)
-	{
-        if (video_task_paused) {
-            xQueueReceive(vidQueue, &bmp, portMAX_DELAY);
-            continue;
-        }
-		xQueuePeek(vidQueue, &bmp, portMAX_DELAY);
-
-        if (bmp == 1) break;
-
-        ili9341_write_frame_nes(bmp, myPalette);
-
-		xQueueReceive(vidQueue, &bmp, portMAX_DELAY);
-	}
-
-    exitVideoTaskFlag = true;
-
-    vTaskDelete(NULL);
-
-    while(1){}
+    // nothing to do, frames are rendered straight into buffers that go to
+    // the video task through the frame exchange
 }
 
 void nes_pause_video_task() {
-    video_task_paused = true;
+    display_pipeline_stop();
 }
 
 void nes_resume_video_task() {
-    video_task_paused = false;
+    display_pipeline_start();
 }
 
 
@@ -348,13 +302,10 @@ static void SaveState()
 
 static void PowerDown()
 {
-    uint16_t* param = 1;
-
     // Stop tasks
     printf("PowerDown: stopping tasks.\n");
 
-    xQueueSend(vidQueue, &param, portMAX_DELAY);
-    while (!exitVideoTaskFlag) { vTaskDelay(1); }
+    display_pipeline_stop();
 
     // state
     printf("PowerDown: Saving state.\n");
@@ -367,21 +318,32 @@ static int ConvertJoystickInput()
 
     static struct InputState state;
     get_input_state(&state);
+    // A+B+LEFT rewinds for as long as it is held, so it is not one-shot like the rest
+    rewind_set_active(state.a && state.b && state.left);
     if(state.a && state.b) {
-        if(special_func_ready && state.up) {
+        if(state.left) {
+            special_func_ready = false;
+            return 0b0110000011111001;
+        } else if(special_func_ready && state.up) {
             special_func_ready = false;
             set_audio_volume(get_audio_volume() + 10);
+            overlay_show_volume(get_audio_volume());
             return 0b0110000011111001;
         } else if(special_func_ready && state.down) {
             special_func_ready = false;
             set_audio_volume(get_audio_volume() - 10);
+            overlay_show_volume(get_audio_volume());
+            return 0b0110000011111001;
+        } else if(special_func_ready && state.right) {
+            special_func_ready = false;
+            frame_policy_cycle_speed();
             return 0b0110000011111001;
         } else if(special_func_ready && state.start) {
             special_func_ready = false;
             state.select = 1;
             state.a = 0;
             state.b = 0;
-        } else if(!(state.up || state.down || state.start)) {
+        } else if(!(state.up || state.down || state.right || state.start)) {
             special_func_ready = true;
         } else {
             // best guess for no buttons pressed
@@ -474,8 +436,17 @@ int osd_init()
         abort();
     }
 
-	vidQueue=xQueueCreate(1, sizeof(bitmap_t *));
-	xTaskCreatePinnedToCore(&videoTask, "videoTask", 6*1024, NULL, 20, NULL, 1);
+	init_frame_bitmaps();
+	struct DisplaySource source = {
+		.format = DISPLAY_SOURCE_INDEXED,
+		.width = NES_GAME_WIDTH,
+		.height = NES_GAME_HEIGHT,
+		.pitch = NES_FRAME_PITCH,
+	};
+	display_pipeline_init(&source);
+	display_pipeline_set_palette(get_nes_palette());
+	display_pipeline_set_overlay(overlay_draw);
+	display_pipeline_start();
 
     osd_initinput();
 
@@ -10,6 +10,7 @@
 #include "badge_input.h"
 #include "logger.hpp"
 #include "mmap.hpp"
+#include "overlay.h"
 #include "rom_info.hpp"
 #include "menu.hpp"
 
@@ -210,6 +211,8 @@ protected:
       break;
     case Menu::Action::SAVE:
       save();
+      // shown over the game once it resumes
+      overlay_show_saved();
       break;
     case Menu::Action::LOAD:
       load();
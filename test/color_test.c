@@ -0,0 +1,164 @@
+/*
+** Checks that the colors the emulators build are what the panel takes, the
+** same bytes LVGL's own colors have with LV_COLOR_16_SWAP (the shipped
+** config), for make_color() and the palettes built from it: gnuboy's PAL2
+** and the NES palette.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "i80_lcd.h"
+
+#include "gnuboy/defs.h"
+#include "gnuboy/fb.h"
+#include "gnuboy/hw.h"
+#include "gnuboy/lcd.h"
+#include "gnuboy/mem.h"
+
+#include <noftypes.h>
+#include <bitmap.h>
+#include <nes_pal.h>
+#include <osd.h>
+
+/* lv_color16_t and LV_COLOR_MAKE16 from LVGL 8's lv_color.h with
+** LV_COLOR_16_SWAP set
+*/
+typedef union
+{
+   struct
+   {
+      uint16_t green_h : 3;
+      uint16_t red : 5;
+      uint16_t blue : 5;
+      uint16_t green_l : 3;
+   } ch;
+   uint16_t full;
+} lv_color16_t;
+
+static uint16_t lv_color_make(uint8_t r8, uint8_t g8, uint8_t b8)
+{
+   lv_color16_t c = {{(uint8_t) ((g8 >> 5) & 0x7U), (uint8_t) ((r8 >> 3) & 0x1FU),
+                      (uint8_t) ((b8 >> 3) & 0x1FU), (uint8_t) ((g8 >> 2) & 0x7U)}};
+   return c.full;
+}
+
+/* what lcd.c needs from the rest of gnuboy and the hal */
+struct hw hw;
+struct ram ram;
+struct fb fb;
+uint16_t *displayBuffer[3];
+void frame_exchange_lines_done(int num_lines) {}
+int frame_policy_should_render() { return 1; }
+
+static int failures;
+
+static void check(const char *what, int i, uint16_t got, uint16_t want)
+{
+   if (got == want)
+      return;
+   if (failures++ < 10)
+      printf("FAIL: %s %d is %04x, LVGL has %04x\n", what, i, got, want);
+}
+
+static void check_make_color(void)
+{
+   static int seen[1 << 16];
+   int rgb, num_seen = 0;
+
+   for (rgb = 0; rgb < (1 << 24); rgb++)
+   {
+      uint8_t r = rgb >> 16, g = rgb >> 8, b = rgb;
+      uint16_t color = make_color(r, g, b);
+      uint8_t bytes[2];
+
+      check("make_color of rgb", rgb, color, lv_color_make(r, g, b));
+
+      /* RGB565 high byte first in memory is what goes over the bus */
+      memcpy(bytes, &color, sizeof color);
+      check("bytes of rgb", rgb, (bytes[0] << 8) | bytes[1],
+            ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3));
+
+      if (!seen[color]++)
+         num_seen++;
+   }
+   if (num_seen != 1 << 16)
+   {
+      printf("FAIL: make_color makes %d of the 65536 colors\n", num_seen);
+      failures++;
+   }
+}
+
+/* every CGB color, into each palette entry in turn */
+static void check_gnuboy(void)
+{
+   int c;
+
+   hw.cgb = 1;
+   lcd_reset();
+   for (c = 0; c < 0x8000; c++)
+   {
+      int entry = c & 63;
+      int r = c & 0x1f, g = (c >> 5) & 0x1f, b = (c >> 10) & 0x1f;
+
+      pal_write(entry << 1, c & 0xff);
+      pal_write((entry << 1) | 1, c >> 8);
+      check("gnuboy PAL2 of cgb color", c, scan.pal2[entry], lv_color_make(r << 3, g << 3, b << 3));
+   }
+
+   /* DMG shades go through the same entries, from the colors the shade
+   ** map picks (pal_write_dmg() stores them in lcd.pal like the CGB does)
+   */
+   hw.cgb = 0;
+   lcd_reset();
+   for (c = 0; c < 256; c++)
+   {
+      int map, j;
+
+      for (map = 0; map < 4; map++)
+      {
+         int entry = ((map & 2) ? 32 : 0) + ((map & 1) ? 4 : 0);
+
+         pal_write_dmg(entry << 1, map, c);
+         for (j = entry; j < entry + 4; j++)
+         {
+            int color = lcd.pal[j << 1] | (lcd.pal[(j << 1) | 1] << 8);
+            int r = color & 0x1f, g = (color >> 5) & 0x1f, b = (color >> 10) & 0x1f;
+            check("gnuboy PAL2 of dmg shade", j, scan.pal2[j], lv_color_make(r << 3, g << 3, b << 3));
+         }
+      }
+   }
+}
+
+static void check_nes_palette(const char *what, const rgb_t *pal64)
+{
+   rgb_t pal[256];
+   const uint16_t *built;
+   int i;
+
+   /* the PPU repeats the 64 colors through its 256 entries */
+   for (i = 0; i < 256; i++)
+      pal[i] = pal64[i & 63];
+   nes_build_palette(pal);
+   built = get_nes_palette();
+   for (i = 0; i < 256; i++)
+      check(what, i, built[i], lv_color_make(pal[i].r, pal[i].g, pal[i].b));
+}
+
+int main(void)
+{
+   check_make_color();
+   check_gnuboy();
+   pal_generate();
+   check_nes_palette("NES generated palette entry", nes_palette);
+   check_nes_palette("NES shady palette entry", shady_palette);
+
+   if (failures)
+   {
+      printf("%d checks failed\n", failures);
+      return 1;
+   }
+   printf("make_color, gnuboy PAL2 and the NES palettes match LVGL's swapped colors\n");
+   return 0;
+}
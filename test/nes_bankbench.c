@@ -0,0 +1,66 @@
+/*
+** Runs mmc_bankbench() on the host, for a 256K PRG / 128K CHR cart like
+** most MMC3 games. It times 8K PRG switches at $8000 through the CPU
+** context round trip mmc_bankrom() used to make and with
+** nes6502_setbanks().
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <noftypes.h>
+#include <nes6502.h>
+#include <nes_mmc.h>
+#include <nes_ppu.h>
+#include <nes_rom.h>
+
+/* what nes_mmc.c needs from the PPU, the mapper list and the rest of
+** nofrendo
+*/
+void ppu_setlatchfunc(ppulatchfunc_t func) {}
+void ppu_setvromswitch(ppuvromswitch_t func) {}
+void ppu_mirrorhipages(void) {}
+void ppu_mirror(int nt1, int nt2, int nt3, int nt4) {}
+void ppu_setpage(int size, int page_num, uint8 *location) {}
+int log_printf(const char *format, ...) { return 0; }
+void *_my_malloc(int size) { return malloc(size); }
+
+static mapintf_t map4_intf = { 4, "MMC3" };
+mapintf_t *mappers[] = { &map4_intf, NULL };
+
+static uint8 ram[0x800];
+static uint8 prg[256 * 1024];
+static uint8 chr[128 * 1024];
+
+int main(void)
+{
+   rominfo_t cart;
+   nes6502_context cpu;
+   mmc_t *mmc;
+   int run;
+
+   memset(&cpu, 0, sizeof cpu);
+   cpu.mem_page[0] = ram;
+   nes6502_setcontext(&cpu);
+
+   memset(&cart, 0, sizeof cart);
+   cart.rom = prg;
+   cart.vrom = chr;
+   cart.rom_banks = sizeof prg / 0x4000;
+   cart.vrom_banks = sizeof chr / 0x2000;
+   cart.mapper_number = 4;
+   mmc = mmc_create(&cart);
+   if (NULL == mmc)
+   {
+      printf("FAIL: no mapper\n");
+      return 1;
+   }
+
+   /* a few runs, so the spread shows */
+   for (run = 0; run < 3; run++)
+      mmc_bankbench();
+
+   mmc_destroy(&mmc);
+   return 0;
+}
@@ -0,0 +1,85 @@
+/*
+** Runs nes6502_membench() on the host, with the handler lists
+** build_address_handlers() in nes.c makes for a plain cart (the default
+** handlers) and for an MMC5 cart (the most handlers any mapper adds).
+** It times reads of the registers games poll, through the full handler
+** list as the CPU did before nes6502_compilehandlers() and through the
+** page lists.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <noftypes.h>
+#include "nes6502.h"
+
+#define  LAST_MEMORY_HANDLER  { -1, -1, NULL }
+
+static uint8 ram[0x800];
+
+static uint8 ram_read(uint32 address) { return ram[address & 0x7FF]; }
+static uint8 ppu_read(uint32 address) { return 0x80; }
+static uint8 apu_read(uint32 address) { return 0x40; }
+static uint8 ppu_readhigh(uint32 address) { return 0x41; }
+static uint8 mmc5_read(uint32 address) { return 0; }
+static uint8 map5_read(uint32 address) { return 0; }
+static uint8 read_protect(uint32 address) { return 0xFF; }
+static void any_write(uint32 address, uint8 value) { ram[address & 0x7FF] = value; }
+
+static nes6502_memread plain_read[] =
+{
+   { 0x0800, 0x1FFF, ram_read },
+   { 0x2000, 0x3FFF, ppu_read },
+   { 0x4000, 0x4015, apu_read },
+   { 0x4016, 0x4017, ppu_readhigh },
+   { 0x4018, 0x5FFF, read_protect },
+   LAST_MEMORY_HANDLER
+};
+
+static nes6502_memread mmc5_read_handlers[] =
+{
+   { 0x0800, 0x1FFF, ram_read },
+   { 0x2000, 0x3FFF, ppu_read },
+   { 0x4000, 0x4015, apu_read },
+   { 0x4016, 0x4017, ppu_readhigh },
+   { 0x5205, 0x5206, mmc5_read },
+   { 0x5204, 0x5204, map5_read },
+   { 0x4018, 0x5FFF, read_protect },
+   LAST_MEMORY_HANDLER
+};
+
+static nes6502_memwrite writes[] =
+{
+   { 0x0800, 0x1FFF, any_write },
+   { 0x2000, 0x3FFF, any_write },
+   { 0x4000, 0x4017, any_write },
+   LAST_MEMORY_HANDLER
+};
+
+static void bench(const char *cart, nes6502_memread *reads)
+{
+   nes6502_context cpu;
+
+   memset(&cpu, 0, sizeof cpu);
+   cpu.mem_page[0] = ram;
+   cpu.read_handler = reads;
+   cpu.write_handler = writes;
+   nes6502_setcontext(&cpu);
+   nes6502_compilehandlers();
+
+   printf("%s cart:\n", cart);
+   nes6502_membench();
+}
+
+int main(void)
+{
+   int run;
+
+   /* a few runs, so the spread shows */
+   for (run = 0; run < 3; run++)
+   {
+      bench("plain", plain_read);
+      bench("MMC5", mmc5_read_handlers);
+   }
+   return 0;
+}
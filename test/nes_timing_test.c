@@ -0,0 +1,133 @@
+/*
+** Runs the NES frame loop's timing (nes_renderframe stopping the CPU at the
+** start of every line, the way it does for mappers that count scanlines)
+** with the integer dot scheme in nes_timing.h and with the float carry it
+** replaced, and checks that the integer one never drifts from the real
+** 89342 dots a frame.
+**
+** Where an instruction ends past a line start is the only thing that
+** matters to the timing, so the CPU is modelled as overrunning each stop by
+** a pseudo random 0-6 cycles.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <nes_timing.h>
+
+/* the float scheme from before, as nes.c had it */
+#define  NES_CLOCK_DIVIDER    12
+#define  NES_SCANLINE_CYCLES  (1364.0 / NES_CLOCK_DIVIDER)
+
+#define  FRAMES_PER_MINUTE    (60 * 60)
+#define  MINUTES              60
+#define  MAX_OVERRUN          6
+
+static unsigned int rng_state;
+
+static int overrun(void)
+{
+   rng_state = rng_state * 1103515245 + 12345;
+   return (rng_state >> 16) % (MAX_OVERRUN + 1);
+}
+
+static double now_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* one frame, returning the CPU cycles it ran */
+static int run_frame_int(int *frame_dots)
+{
+   int now = 0;
+   int line;
+
+   for (line = 1; line <= NES_FRAME_LINES; line++)
+   {
+      int cycle = NES_LINE_CYCLE(line, *frame_dots);
+      if (now < cycle)
+         now = cycle + overrun();
+   }
+
+   *frame_dots = NES_CARRY_DOTS(*frame_dots, now);
+   return now;
+}
+
+static int run_frame_float(float *scanline_cycles)
+{
+   int now = 0;
+   int line;
+
+   for (line = 1; line <= NES_FRAME_LINES; line++)
+   {
+      int cycle = (int) (line * (float) NES_SCANLINE_CYCLES + *scanline_cycles);
+      if (now < cycle)
+         now = cycle + overrun();
+   }
+
+   *scanline_cycles += NES_FRAME_LINES * (float) NES_SCANLINE_CYCLES - now;
+   return now;
+}
+
+int main(void)
+{
+   int frame_dots = 0;
+   float scanline_cycles = 0;
+   long long int_cycles = 0, float_cycles = 0;
+   int min_frame = 1 << 30, max_frame = 0;
+   double int_ns = 0, float_ns = 0;
+   int minute, frame;
+
+   printf("minute  integer drift (dots)  float drift (dots)\n");
+   for (minute = 1; minute <= MINUTES; minute++)
+   {
+      double start;
+      long long ideal_dots = (long long) minute * FRAMES_PER_MINUTE * NES_FRAME_DOTS;
+      long long int_drift, float_drift;
+
+      rng_state = minute;
+      start = now_ns();
+      for (frame = 0; frame < FRAMES_PER_MINUTE; frame++)
+      {
+         int cycles = run_frame_int(&frame_dots);
+         int_cycles += cycles;
+         if (cycles < min_frame)
+            min_frame = cycles;
+         if (cycles > max_frame)
+            max_frame = cycles;
+
+         /* what the last line ran over is owed back by the next frame,
+         ** anything more would build up
+         */
+         if (frame_dots <= -(MAX_OVERRUN + 1) * NES_CPU_DOTS || frame_dots >= NES_CPU_DOTS)
+         {
+            printf("FAIL: integer scheme owes %d dots after frame %d of minute %d\n",
+                   frame_dots, frame, minute);
+            return 1;
+         }
+      }
+      int_ns += now_ns() - start;
+
+      /* same CPU for both */
+      rng_state = minute;
+      start = now_ns();
+      for (frame = 0; frame < FRAMES_PER_MINUTE; frame++)
+         float_cycles += run_frame_float(&scanline_cycles);
+      float_ns += now_ns() - start;
+
+      int_drift = int_cycles * NES_CPU_DOTS - ideal_dots;
+      float_drift = float_cycles * NES_CPU_DOTS - ideal_dots;
+      if (1 == minute || 0 == minute % 10)
+         printf("%6d  %20lld  %18lld\n", minute, int_drift, float_drift);
+   }
+
+   printf("integer: %d..%d cycles a frame, avg %.4f (exact %.4f)\n", min_frame, max_frame,
+          (double) int_cycles / (MINUTES * FRAMES_PER_MINUTE), NES_FRAME_DOTS / (double) NES_CPU_DOTS);
+   printf("host time per frame: integer %.1f ns, float %.1f ns\n",
+          int_ns / (MINUTES * FRAMES_PER_MINUTE), float_ns / (MINUTES * FRAMES_PER_MINUTE));
+
+   return 0;
+}
@@ -0,0 +1,134 @@
+// Times the scaler in each of the modes the emulators use it for, in output
+// pixels per second, next to the 1:1 copy / palette lookup the display
+// pipeline does without one. Checks first that a flat frame comes out flat
+// in every filter, which catches weights that don't add up.
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+
+#include "i80_lcd.h"
+#include "scaler.h"
+
+static constexpr int ROUNDS = 500;
+
+struct Mode {
+  const char *name;
+  int src_width;
+  int src_height;
+  int dst_width;
+  int dst_height;
+  bool indexed;
+};
+
+// as set up in gameboy.cpp and video_audio.c
+static const Mode MODES[] = {
+  {"GB fit", 160, 144, 266, 240, false},
+  {"GB fill", 160, 144, 320, 240, false},
+  {"NES fill", 256, 224, 320, 224, true},
+};
+
+static const struct {
+  const char *name;
+  ScalerFilter filter;
+} FILTERS[] = {
+  {"nearest", SCALER_NEAREST},
+  {"sharp bilinear", SCALER_SHARP_BILINEAR},
+  {"bilinear h", SCALER_BILINEAR_H},
+};
+
+static uint16_t frame_[256 * 224];
+static uint8_t indexed_[256 * 224];
+static uint16_t palette_[256];
+static uint16_t line_[SCALER_MAX_WIDTH];
+static Scaler scaler_;
+
+template <typename F>
+static double mpix_per_s(int pixels_per_round, F &&round) {
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < ROUNDS; r++) {
+    round();
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return (double)pixels_per_round * ROUNDS / elapsed.count() / 1e6;
+}
+
+static bool check_flat(const Mode &mode, ScalerFilter filter) {
+  uint16_t color = make_color(200, 100, 50);
+  std::fill_n(frame_, mode.src_width * mode.src_height, color);
+  std::fill_n(indexed_, mode.src_width * mode.src_height, 7);
+  std::fill_n(palette_, 256, make_color(0, 0, 0));
+  palette_[7] = color;
+  scaler_ = {};
+  scaler_init(&scaler_, mode.src_width, mode.src_height, mode.dst_width, mode.dst_height, filter);
+  for (int y = 0; y < mode.dst_height; y++) {
+    if (mode.indexed) {
+      scaler_line_indexed(&scaler_, line_, y, indexed_, mode.src_width, palette_);
+    } else {
+      scaler_line(&scaler_, line_, y, frame_, mode.src_width);
+    }
+    for (int x = 0; x < mode.dst_width; x++) {
+      if (line_[x] != color) {
+        printf("FAIL: %s, filter %d: pixel %d,%d is %04x, not %04x\n", mode.name, filter,
+               x, y, line_[x], color);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+int main() {
+  for (const Mode &mode : MODES) {
+    for (const auto &f : FILTERS) {
+      if (!check_flat(mode, f.filter)) {
+        return 1;
+      }
+    }
+  }
+
+  // something that isn't flat, so nothing is skipped
+  for (int i = 0; i < 256 * 224; i++) {
+    frame_[i] = make_color(i * 7, i * 3, i * 11);
+    indexed_[i] = i * 13;
+  }
+  for (int i = 0; i < 256; i++) {
+    palette_[i] = make_color(i, 255 - i, i * 3);
+  }
+
+  volatile uint16_t sink = 0;
+  printf("%-9s %-15s %10s\n", "mode", "filter", "Mpix/s");
+  for (const Mode &mode : MODES) {
+    // what the pipeline does with no scaler, one source line per output line
+    double copy = mpix_per_s(mode.src_width * mode.src_height, [&] {
+      for (int y = 0; y < mode.src_height; y++) {
+        if (mode.indexed) {
+          const uint8_t *src = &indexed_[y * mode.src_width];
+          for (int x = 0; x < mode.src_width; x++) {
+            line_[x] = palette_[src[x]];
+          }
+        } else {
+          std::copy_n(&frame_[y * mode.src_width], mode.src_width, line_);
+        }
+        sink = sink + line_[y % mode.src_width];
+      }
+    });
+    printf("%-9s %-15s %10.0f\n", mode.name, "1:1 (no scaler)", copy);
+    for (const auto &f : FILTERS) {
+      scaler_ = {};
+      scaler_init(&scaler_, mode.src_width, mode.src_height, mode.dst_width, mode.dst_height, f.filter);
+      double scaled = mpix_per_s(mode.dst_width * mode.dst_height, [&] {
+        for (int y = 0; y < mode.dst_height; y++) {
+          if (mode.indexed) {
+            scaler_line_indexed(&scaler_, line_, y, indexed_, mode.src_width, palette_);
+          } else {
+            scaler_line(&scaler_, line_, y, frame_, mode.src_width);
+          }
+          sink = sink + line_[y % mode.dst_width];
+        }
+      });
+      printf("%-9s %-15s %10.0f\n", mode.name, f.name, scaled);
+    }
+  }
+  return 0;
+}
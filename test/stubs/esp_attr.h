@@ -0,0 +1,5 @@
+#pragma once
+
+// placement attributes mean nothing on the host
+#define IRAM_ATTR
+#define DRAM_ATTR
@@ -0,0 +1,3 @@
+#pragma once
+
+// no Kconfig on the host, everything takes its default